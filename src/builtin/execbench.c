@@ -0,0 +1,59 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <string.h>
+
+// 测量 execve 的延迟：执行一个立即退出的程序并等待它结束
+// 子进程执行的是自己，带上 -c 参数直接从 main 返回，耗时主要是加载程序与缺页
+
+#define EXEC_COUNT 32
+
+static char* self = "/bin/execbench.out";
+static char* child_argv[] = {"-c", NULL};
+static char* envp[] = {NULL};
+
+// spawn 直接在新进程中加载程序
+static pid_t spawn_child()
+{
+    return spawn(self, child_argv, envp, NULL);
+}
+
+// vfork 之后子进程 execve
+static pid_t vfork_child()
+{
+    pid_t pid = vfork();
+    if (pid == 0)
+    {
+        execve(self, child_argv, envp);
+        exit(-1);
+    }
+    return pid;
+}
+
+static void bench(char* name, pid_t (*create)())
+{
+    int32 status;
+    u32 failed = 0;
+    u64 start = rdtsc();
+
+    for (size_t i = 0; i < EXEC_COUNT; ++i)
+    {
+        pid_t pid = create();
+        if (pid == EOF || waitpid(pid, &status) == EOF || status)
+            failed++;
+    }
+
+    u32 cycles = (u32)(rdtsc() - start) / EXEC_COUNT;
+    printf("%s + exec + wait: %u cycles/exec, %u failed\n", name, cycles, failed);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && !strcmp(argv[1], "-c"))
+        return 0;
+
+    bench("spawn", spawn_child);
+    bench("vfork", vfork_child);
+    return 0;
+}
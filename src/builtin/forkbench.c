@@ -0,0 +1,57 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/memory.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 测量带有大块堆内存的进程 fork 的耗时
+
+#define FORK_COUNT 16
+
+// 链接器给出的程序结束地址
+extern char end[];
+
+int main(int argc, char* argv[])
+{
+    // 堆大小，单位 M，默认 32M
+    u32 size = 32;
+    if (argc > 1)
+        size = atoi(argv[1]);
+
+    u32 heap = ((u32)end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    u32 heap_end = heap + size * 0x100000;
+    if (brk((void*)heap_end) < 0)
+    {
+        printf("brk %dM failed\n", size);
+        return EOF;
+    }
+
+    // 每一页都写一次，让堆全部映射物理页
+    for (u32 addr = heap; addr < heap_end; addr += PAGE_SIZE)
+        *(u32*)addr = addr;
+
+    u32 total = 0;
+    u32 child_total = 0;
+    for (size_t i = 0; i < FORK_COUNT; ++i)
+    {
+        u64 start = rdtsc();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // 子进程写一页，触发页表与页面的复制
+            u64 begin = rdtsc();
+            *(u32*)heap = 0;
+            exit((u32)(rdtsc() - begin));
+        }
+        total += (u32)(rdtsc() - start);
+
+        int32 status;
+        waitpid(pid, &status);
+        child_total += status;
+    }
+
+    printf("fork heap %dM: parent %d cycles, child first write %d cycles\n",
+           size, total / FORK_COUNT, child_total / FORK_COUNT);
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 统计空闲与只有一个任务运行时，每秒的时钟中断次数
+// 固定周期的时钟每秒中断 hz 次，跳过的时间片越多中断越少
+
+static void report(char* name, clock_stat_t* start, clock_stat_t* end)
+{
+    u32 ticks = end->jiffies - start->jiffies;
+    u32 irqs = end->irqs - start->irqs;
+    u32 skipped = end->skipped - start->skipped;
+    u32 seconds = MAX(ticks / end->hz, 1);
+
+    printf("%s: %u ticks, %u irqs, %u skipped, %u irqs/s (periodic %u irqs/s)\n",
+           name, ticks, irqs, skipped, irqs / seconds, end->hz);
+}
+
+int main(int argc, char* argv[])
+{
+    // 每项统计的秒数，默认 5 秒
+    u32 seconds = 5;
+    if (argc > 1)
+        seconds = atoi(argv[1]);
+
+    clock_stat_t start;
+    clock_stat_t end;
+
+    // 睡眠期间系统空闲
+    clock_stat(&start);
+    sleep(seconds * 1000);
+    clock_stat(&end);
+    report("idle", &start, &end);
+
+    // 只有自己一个任务在运行
+    clock_stat(&start);
+    u32 deadline = start.jiffies + seconds * start.hz;
+    do
+    {
+        clock_stat(&end);
+    } while ((int)(end.jiffies - deadline) < 0);
+    report("busy", &start, &end);
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 堆内存分配的吞吐量：小块成对分配释放、随机顺序释放、realloc 逐步增长与大块分配
+// 输出每次操作的平均时钟周期，并校验块中的数据没有被破坏
+
+#define SLOT_COUNT 4096
+#define LARGE_SIZE 0x40000
+
+static void* slots[SLOT_COUNT];
+static u32 sizes[SLOT_COUNT];
+
+// 每个块的第一个与最后一个字节由序号决定
+static void mark(u32 idx)
+{
+    u8* ptr = slots[idx];
+    ptr[0] = idx;
+    ptr[sizes[idx] - 1] = idx;
+}
+
+static bool check(u32 idx)
+{
+    u8* ptr = slots[idx];
+    return ptr[0] == (u8)idx && ptr[sizes[idx] - 1] == (u8)idx;
+}
+
+static void report(char* name, u32 ops, u64 cycles)
+{
+    printf("%s: %u ops, %u cycles/op\n", name, ops, (u32)div_u64(cycles, ops, NULL));
+}
+
+// 分配之后立即释放，总是重用同一块
+static void bench_pair(u32 rounds)
+{
+    u64 start = rdtsc();
+    for (u32 i = 0; i < rounds; i++)
+    {
+        void* ptr = malloc(16 + (i & 0xff));
+        free(ptr);
+    }
+    report("malloc/free pair", rounds * 2, rdtsc() - start);
+}
+
+// 占满所有槽位，之后随机释放再分配不同大小的块，最后全部释放
+static int bench_random(u32 rounds)
+{
+    u64 start = rdtsc();
+    for (u32 i = 0; i < SLOT_COUNT; i++)
+    {
+        sizes[i] = 8 + rand() % 1024;
+        slots[i] = malloc(sizes[i]);
+        mark(i);
+    }
+
+    for (u32 i = 0; i < rounds; i++)
+    {
+        u32 idx = rand() % SLOT_COUNT;
+        if (!check(idx))
+        {
+            printf("block %d corrupted\n", idx);
+            return EOF;
+        }
+        free(slots[idx]);
+        sizes[idx] = 8 + rand() % 1024;
+        slots[idx] = malloc(sizes[idx]);
+        mark(idx);
+    }
+
+    for (u32 i = 0; i < SLOT_COUNT; i++)
+        free(slots[i]);
+    report("random malloc/free", (SLOT_COUNT + rounds) * 2, rdtsc() - start);
+    return 0;
+}
+
+// 每个块从 16 字节逐步增长，与其他块交错
+static int bench_realloc(u32 count)
+{
+    u32 ops = 0;
+    u64 start = rdtsc();
+    for (u32 i = 0; i < count; i++)
+    {
+        sizes[i] = 16;
+        slots[i] = malloc(sizes[i]);
+        mark(i);
+    }
+
+    for (u32 size = 32; size <= 4096; size += 32)
+    {
+        for (u32 i = 0; i < count; i++)
+        {
+            // 原来的数据应该保留下来
+            slots[i] = realloc(slots[i], size);
+            if (!check(i))
+            {
+                printf("block %d corrupted\n", i);
+                return EOF;
+            }
+            sizes[i] = size;
+            mark(i);
+            ops++;
+        }
+    }
+
+    for (u32 i = 0; i < count; i++)
+        free(slots[i]);
+    report("realloc grow", ops, rdtsc() - start);
+    return 0;
+}
+
+// 大块通过 mmap 分配，写一页之后释放
+static void bench_large(u32 rounds)
+{
+    u64 start = rdtsc();
+    for (u32 i = 0; i < rounds; i++)
+    {
+        char* ptr = malloc(LARGE_SIZE);
+        ptr[0] = i;
+        free(ptr);
+    }
+    report("large malloc/free", rounds * 2, rdtsc() - start);
+}
+
+int main(int argc, char* argv[])
+{
+    // 随机分配释放的轮数，默认 100000
+    u32 rounds = 100000;
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+
+    bench_pair(rounds);
+    if (bench_random(rounds) < 0)
+        return EOF;
+    if (bench_realloc(256) < 0)
+        return EOF;
+    bench_large(rounds / 100 + 1);
+    return 0;
+}
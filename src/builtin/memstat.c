@@ -0,0 +1,45 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/memory.h>
+#include <onix/slab.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 输出内存管理的统计信息
+
+// 最多输出的对象缓存数量
+#define SLAB_STAT_NR 32
+
+// 命中率的百分比，没有请求时为 0
+static u32 percent(u32 hits, u32 misses)
+{
+    u32 total = hits + misses;
+    if (!total)
+        return 0;
+    return (u32)div_u64((u64)hits * 100, total, NULL);
+}
+
+int main(int argc, char* argv[])
+{
+    memory_stat_t stat;
+    memory_stat(&stat);
+
+    printf("zero pool: %u pages, %u hits, %u misses, %u%% hit\n",
+           stat.zero_count, stat.zero_hits, stat.zero_misses,
+           percent(stat.zero_hits, stat.zero_misses));
+    printf("kernel zero pool: %u pages, %u hits, %u misses, %u%% hit\n",
+           stat.kzero_count, stat.kzero_hits, stat.kzero_misses,
+           percent(stat.kzero_hits, stat.kzero_misses));
+    printf("tlb: %u invlpg, %u full flushes\n", stat.tlb_invlpg, stat.tlb_full);
+
+    static slab_stat_t slabs[SLAB_STAT_NR];
+    int count = slab_stat(slabs, SLAB_STAT_NR);
+    printf("%-16s %6s %6s %8s %10s %10s\n", "cache", "size", "slabs", "active", "allocs", "frees");
+    for (int i = 0; i < count; i++)
+    {
+        slab_stat_t* slab = slabs + i;
+        printf("%-16s %6u %6u %8u %10u %10u\n", slab->name, slab->object_size,
+               slab->slabs, slab->active, slab->allocs, slab->frees);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/memory.h>
+#include <onix/fs.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 比较 read 与 mmap 顺序、随机访问文件的耗时
+
+#define BENCH_FILE "/mmap.dat"
+
+static char buf[PAGE_SIZE];
+
+static u32 bench_read(fd_t fd, u32 pages, bool random)
+{
+    u32 sum = 0;
+    for (u32 i = 0; i < pages; ++i)
+    {
+        u32 idx = random ? rand() % pages : i;
+        lseek(fd, idx * PAGE_SIZE, SEEK_SET);
+        read(fd, buf, PAGE_SIZE);
+        sum += buf[0];
+    }
+    return sum;
+}
+
+static u32 bench_mmap(fd_t fd, u32 pages, bool random)
+{
+    char* addr = mmap(0, pages * PAGE_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    if ((int)addr == EOF)
+        return 0;
+
+    u32 sum = 0;
+    for (u32 i = 0; i < pages; ++i)
+    {
+        u32 idx = random ? rand() % pages : i;
+        sum += addr[idx * PAGE_SIZE];
+    }
+    munmap(addr, pages * PAGE_SIZE);
+    return sum;
+}
+
+int main(int argc, char* argv[])
+{
+    // 文件大小，单位 K，默认 512K
+    u32 size = 512;
+    if (argc > 1)
+        size = atoi(argv[1]);
+    u32 pages = size * 1024 / PAGE_SIZE;
+
+    fd_t fd = open(BENCH_FILE, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == EOF)
+    {
+        printf("open %s failed\n", BENCH_FILE);
+        return EOF;
+    }
+
+    for (u32 i = 0; i < pages; ++i)
+    {
+        buf[0] = (char)i;
+        write(fd, buf, PAGE_SIZE);
+    }
+
+    u64 start = rdtsc();
+    bench_read(fd, pages, false);
+    u32 read_seq = (u32)(rdtsc() - start);
+
+    start = rdtsc();
+    bench_mmap(fd, pages, false);
+    u32 mmap_seq = (u32)(rdtsc() - start);
+
+    srand(1);
+    start = rdtsc();
+    bench_read(fd, pages, true);
+    u32 read_rand = (u32)(rdtsc() - start);
+
+    srand(1);
+    start = rdtsc();
+    bench_mmap(fd, pages, true);
+    u32 mmap_rand = (u32)(rdtsc() - start);
+
+    printf("file %uK sequential: read %u mmap %u cycles/page\n",
+           size, read_seq / pages, mmap_seq / pages);
+    printf("file %uK random: read %u mmap %u cycles/page\n",
+           size, read_rand / pages, mmap_rand / pages);
+
+    close(fd);
+    unlink(BENCH_FILE);
+    return 0;
+}
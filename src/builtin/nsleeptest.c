@@ -0,0 +1,82 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 测量 nanosleep 的精度：请求不同的睡眠时间，用单调时间测量实际睡眠的时间
+// 每种时间睡眠多次，输出平均与最大的超出时间，单位为微秒
+
+#define ROUND_COUNT 20
+
+// 默认测量的睡眠时间，微秒
+static u32 default_times[] = {50, 200, 1000, 3000, 15000, 50000};
+
+static u64 now_ns(int clockid)
+{
+    timespec ts;
+    clock_gettime(clockid, &ts);
+    return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int bench(u32 usec, u32 rounds)
+{
+    timespec req;
+    req.tv_sec = usec / 1000000;
+    req.tv_nsec = (usec % 1000000) * 1000;
+
+    u64 request = (u64)usec * 1000;
+    u64 total = 0;
+    u32 max = 0;
+    u32 early = 0;
+    for (u32 i = 0; i < rounds; ++i)
+    {
+        u64 start = now_ns(CLOCK_MONOTONIC);
+        if (nanosleep(&req, NULL) < 0)
+        {
+            printf("nanosleep failed\n");
+            return EOF;
+        }
+        u64 elapsed = now_ns(CLOCK_MONOTONIC) - start;
+
+        // 醒得比请求的早是错误
+        if (elapsed < request)
+        {
+            early++;
+            continue;
+        }
+        u32 over = (u32)div_u64(elapsed - request, 1000, NULL);
+        total += over;
+        max = MAX(max, over);
+    }
+
+    printf("nanosleep %u us: avg over %u us, max over %u us, %u early\n",
+           usec, (u32)div_u64(total, rounds, NULL), max, early);
+    return early ? EOF : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // TSC 校准的误差：对比时间片计时的睡眠与单调时间
+    u64 start = now_ns(CLOCK_MONOTONIC);
+    sleep(1000);
+    u32 usec = (u32)div_u64(now_ns(CLOCK_MONOTONIC) - start, 1000, NULL);
+    printf("sleep 1000 ms: monotonic %u us\n", usec);
+
+    timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    printf("realtime %u.%09u, time %u\n", real.tv_sec, real.tv_nsec, time());
+
+    // 参数为要测量的睡眠时间，单位为微秒
+    int ret = 0;
+    if (argc == 1)
+    {
+        for (size_t i = 0; i < sizeof(default_times) / sizeof(u32); ++i)
+            ret |= bench(default_times[i], ROUND_COUNT);
+        return ret;
+    }
+
+    for (int i = 1; i < argc; ++i)
+        ret |= bench(atoi(argv[i]), ROUND_COUNT);
+    return ret;
+}
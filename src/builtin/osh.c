@@ -269,44 +269,40 @@ rollback:
 
 pid_t builtin_command(char *filename, char *argv[], fd_t infd, fd_t outfd, fd_t errfd)
 {
-    int status;
-    pid_t pid = fork();
-    if (pid)
-    {
-        // 对父进程，如果存在重定向，把重定向的文件关闭
-        if (infd != EOF)
-            close(infd);
-        if (outfd != EOF)
-            close(outfd);
-        if (errfd != EOF)
-            close(errfd);
-        // 父进程返回到 exec，等待子进程结束
-        return pid;
-    }
-    
-    // 对子进程
-    if (infd != EOF)
-    {
-        // 存在输入重定向，将 infd 设置到标准输入上
-        fd_t fd = dup2(infd, STDIN_FILENO);
-        close(infd);
-    }
-    if (outfd != EOF)
+    // 子进程的重定向由内核在创建时完成，不用复制 osh 的地址空间
+    spawn_action_t actions[7];
+    spawn_action_t *action = actions;
+
+    fd_t fds[3] = {infd, outfd, errfd};
+    for (fd_t i = STDIN_FILENO; i <= STDERR_FILENO; ++i)
     {
-        // 存在输出重定向，将 outfd 设置到标准输出上
-        fd_t fd = dup2(outfd, STDOUT_FILENO);
-        close(outfd);
+        if (fds[i] == EOF)
+            continue;
+        // 存在重定向，将 fds[i] 设置到标准输入输出上，再关闭
+        action->type = SPAWN_DUP2;
+        action->fd = fds[i];
+        action->newfd = i;
+        action++;
+        action->type = SPAWN_CLOSE;
+        action->fd = fds[i];
+        action++;
     }
-    if (errfd != EOF)
+    action->type = SPAWN_END;
+
+    pid_t pid = spawn(filename, argv, envp, actions);
+
+    // 对父进程，如果存在重定向，把重定向的文件关闭
+    for (fd_t i = STDIN_FILENO; i <= STDERR_FILENO; ++i)
     {
-        // 存在错误输出重定向，将 errfd 设置到标准错误输出上
-        fd_t fd = dup2(errfd, STDERR_FILENO);
-        close(errfd);
+        if (fds[i] != EOF)
+            close(fds[i]);
     }
 
-    // 执行
-    int i = execve(filename, argv, envp);
-    exit(i);
+    if (pid == EOF)
+        printf("osh: spawn %s failure\n", filename);
+
+    // 父进程返回到 exec，等待子进程结束
+    return pid;
 }
 
 void builtin_exec(int argc, char* argv[])
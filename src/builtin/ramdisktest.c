@@ -0,0 +1,169 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/device.h>
+#include <onix/stat.h>
+#include <onix/fs.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 运行时创建一个虚拟磁盘，检查没有写过与丢弃之后的扇区读为 0
+// 再在上面建立文件系统，写入并校验一个文件
+
+#define RAMDISK_DEVICE "/dev/mdb"
+#define TEST_DEVICE "/dev/mdt"
+#define TEST_MOUNT "/ramdisk"
+#define TEST_FILE "/ramdisk/ramdisk.dat"
+
+// 裸设备读写的扇区
+#define TEST_SECTOR 100
+
+static char buf[BLOCK_SIZE];
+
+// 缓冲区的前 len 个字节都为 0
+static bool all_zero(char* data, u32 len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (data[i])
+            return false;
+    }
+    return true;
+}
+
+// 块设备文件以偏移 / BLOCK_SIZE 为扇区号，每次读写一个扇区
+static int sector_io(fd_t fd, idx_t lba, bool is_write)
+{
+    lseek(fd, lba * BLOCK_SIZE, SEEK_SET);
+    if (is_write)
+        return write(fd, buf, BLOCK_SIZE);
+    return read(fd, buf, BLOCK_SIZE);
+}
+
+static int check_sectors(fd_t fd)
+{
+    memset(buf, 0x5a, sizeof(buf));
+    sector_io(fd, TEST_SECTOR, false);
+    if (!all_zero(buf, SECTOR_SIZE))
+    {
+        printf("untouched sector is not zero\n");
+        return EOF;
+    }
+
+    for (size_t i = 0; i < SECTOR_SIZE; i++)
+        buf[i] = i;
+    sector_io(fd, TEST_SECTOR, true);
+    memset(buf, 0, sizeof(buf));
+    sector_io(fd, TEST_SECTOR, false);
+    for (size_t i = 0; i < SECTOR_SIZE; i++)
+    {
+        if (buf[i] != (char)i)
+        {
+            printf("sector read back wrong at %d\n", i);
+            return EOF;
+        }
+    }
+
+    dev_range_t range = {TEST_SECTOR, 1};
+    if (ioctl(fd, DEV_CMD_DISCARD, &range) < 0)
+    {
+        printf("discard failed\n");
+        return EOF;
+    }
+    sector_io(fd, TEST_SECTOR, false);
+    if (!all_zero(buf, SECTOR_SIZE))
+    {
+        printf("discarded sector is not zero\n");
+        return EOF;
+    }
+    return 0;
+}
+
+static int check_file(u32 size)
+{
+    if (mkfs(TEST_DEVICE, 0) < 0)
+    {
+        printf("mkfs %s failed\n", TEST_DEVICE);
+        return EOF;
+    }
+    mkdir(TEST_MOUNT, 0755);
+    if (mount(TEST_DEVICE, TEST_MOUNT, 0) < 0)
+    {
+        printf("mount %s failed\n", TEST_DEVICE);
+        return EOF;
+    }
+
+    int ret = 0;
+    u32 blocks = size * 1024 / BLOCK_SIZE;
+    fd_t fd = open(TEST_FILE, O_CREAT | O_RDWR | O_TRUNC, 0644);
+
+    u64 start = rdtsc();
+    for (u32 i = 0; i < blocks; i++)
+    {
+        memset(buf, i, BLOCK_SIZE);
+        write(fd, buf, BLOCK_SIZE);
+    }
+    u32 write_cycles = (u32)(rdtsc() - start);
+    close(fd);
+
+    fd = open(TEST_FILE, O_RDONLY, 0);
+    start = rdtsc();
+    for (u32 i = 0; i < blocks && !ret; i++)
+    {
+        read(fd, buf, BLOCK_SIZE);
+        if (buf[0] != (char)i || buf[BLOCK_SIZE - 1] != (char)i)
+        {
+            printf("file block %d wrong\n", i);
+            ret = EOF;
+        }
+    }
+    u32 read_cycles = (u32)(rdtsc() - start);
+    close(fd);
+
+    printf("file %uK: write %u read %u cycles/block\n",
+           size, write_cycles / blocks, read_cycles / blocks);
+
+    unlink(TEST_FILE);
+    umount(TEST_MOUNT);
+    return ret;
+}
+
+int main(int argc, char* argv[])
+{
+    // 磁盘与文件的大小，单位 K，默认 16M 的磁盘上写 1M 的文件
+    u32 disk_size = 16 * 1024;
+    u32 file_size = 1024;
+    if (argc > 1)
+        disk_size = atoi(argv[1]);
+    if (argc > 2)
+        file_size = atoi(argv[2]);
+
+    fd_t fd = open(RAMDISK_DEVICE, O_RDONLY, 0);
+    if (fd == EOF)
+    {
+        printf("open %s failed\n", RAMDISK_DEVICE);
+        return EOF;
+    }
+    int dev = ioctl(fd, DEV_CMD_RAMDISK_CREATE, (void*)(disk_size * 1024));
+    close(fd);
+    if (dev == EOF)
+    {
+        printf("create ramdisk %uK failed\n", disk_size);
+        return EOF;
+    }
+
+    // 设备文件可能是上次运行留下的
+    unlink(TEST_DEVICE);
+    mknod(TEST_DEVICE, IFBLK | 0600, dev);
+
+    fd = open(TEST_DEVICE, O_RDWR, 0);
+    int ret = check_sectors(fd);
+    close(fd);
+
+    if (!ret)
+        ret = check_file(file_size);
+
+    printf("ramdisk test %uK: %s\n", disk_size, ret ? "failed" : "ok");
+    return ret;
+}
@@ -0,0 +1,94 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 测量不同数量的可运行进程同时 yield 时，每次进程切换的耗时
+// 所有进程优先级相同，每次 yield 都切换到就绪队列中的下一个进程
+
+#define ROUND_COUNT 1000
+
+// 默认测量的进程数量
+static u32 default_counts[] = {2, 16, 60};
+
+// count 个进程，包括自己，自己 yield rounds 次的期间计时
+// 子进程开始运行时先向管道写一个字节，全部开始之后才计时
+// 子进程 yield 两倍的次数，计时期间所有进程都一直可运行，退出与回收不计入
+static int bench(u32 count, u32 rounds)
+{
+    fd_t ready[2];
+    if (pipe(ready) < 0)
+    {
+        printf("pipe failed\n");
+        return EOF;
+    }
+
+    u32 forked = 1;
+    for (; forked < count; ++forked)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            printf("fork failed\n");
+            break;
+        }
+        if (pid == 0)
+        {
+            char ch = 0;
+            write(ready[1], &ch, 1);
+            for (u32 j = 0; j < rounds * 2; ++j)
+                yield();
+            exit(0);
+        }
+    }
+
+    // 管道只能有一个读进程阻塞，所以由父进程等待所有子进程
+    char buf[64];
+    for (u32 left = forked - 1; left;)
+        left -= read(ready[0], buf, MIN(left, sizeof(buf)));
+
+    u64 start = rdtsc();
+    for (u32 j = 0; j < rounds; ++j)
+        yield();
+    u32 cycles = (u32)(rdtsc() - start);
+
+    for (u32 i = 1; i < forked; ++i)
+    {
+        int32 status;
+        waitpid(-1, &status);
+    }
+    close(ready[0]);
+    close(ready[1]);
+
+    if (forked < count)
+        return EOF;
+
+    u32 switches = count * rounds;
+    printf("schedule: %u tasks, %u switches, %u cycles/switch\n",
+           count, switches, cycles / switches);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // 参数为要测量的进程数量，没有参数时测量 2、16 与 60 个进程
+    u32 rounds = ROUND_COUNT;
+
+    if (argc == 1)
+    {
+        for (size_t i = 0; i < sizeof(default_counts) / sizeof(u32); ++i)
+        {
+            if (bench(default_counts[i], rounds) < 0)
+                return EOF;
+        }
+        return 0;
+    }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (bench(atoi(argv[i]), rounds) < 0)
+            return EOF;
+    }
+    return 0;
+}
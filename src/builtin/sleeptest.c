@@ -0,0 +1,67 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 大量进程同时睡眠，每个进程多次睡眠不同的时间，覆盖时间轮的不同层
+// 所有进程都应该醒来并正常退出，输出总耗时
+
+#define TASK_COUNT 200
+#define SLEEP_ROUNDS 4
+
+// 睡眠时间从几毫秒到几十秒，大部分较短
+static u32 sleep_time()
+{
+    switch (rand() % 4)
+    {
+    case 0:
+        return rand() % 100;
+    case 1:
+    case 2:
+        return rand() % 3000;
+    default:
+        return rand() % 30000;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // 睡眠的进程数量，默认 200，要放得下默认的 32M 内存
+    u32 count = TASK_COUNT;
+    if (argc > 1)
+        count = atoi(argv[1]);
+
+    u64 start = rdtsc();
+    u32 created = 0;
+    for (; created < count; ++created)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // 每个子进程的睡眠时间不同
+            srand(created + 1);
+            for (u32 i = 0; i < SLEEP_ROUNDS; ++i)
+                sleep(sleep_time());
+            exit(0);
+        }
+        if (pid < 0)
+            break;
+    }
+
+    if (created < count)
+        printf("fork failed after %u tasks\n", created);
+
+    u32 failed = 0;
+    for (u32 i = 0; i < created; ++i)
+    {
+        int32 status;
+        if (waitpid(-1, &status) < 0 || status)
+            failed++;
+    }
+
+    u32 mcycles = (u32)((rdtsc() - start) >> 20);
+    printf("sleep test: %u tasks %u rounds each, %u failed, %u Mcycles\n",
+           created, SLEEP_ROUNDS, failed, mcycles);
+    return failed ? EOF : 0;
+}
@@ -0,0 +1,86 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <string.h>
+
+// 比较 fork + execve、vfork + execve 与 spawn 创建进程的速率
+// 子进程执行的是自己，带上 -c 参数立即退出
+
+#define SPAWN_COUNT 32
+
+static char* self = "/bin/spawnbench.out";
+static char* child_argv[] = {"-c", NULL};
+static char* envp[] = {NULL};
+
+typedef enum bench_type_t
+{
+    BENCH_FORK,
+    BENCH_VFORK,
+    BENCH_SPAWN,
+} bench_type_t;
+
+static char* bench_name[] = {
+    "fork",
+    "vfork",
+    "spawn",
+};
+
+static pid_t create_child(bench_type_t type)
+{
+    pid_t pid;
+    switch (type)
+    {
+    case BENCH_FORK:
+        pid = fork();
+        break;
+    case BENCH_VFORK:
+        pid = vfork();
+        break;
+    case BENCH_SPAWN:
+        return spawn(self, child_argv, envp, NULL);
+    }
+
+    if (pid == 0)
+    {
+        execve(self, child_argv, envp);
+        exit(-1);
+    }
+    return pid;
+}
+
+static void bench(bench_type_t type)
+{
+    int32 status;
+    u32 create_cycles = 0;
+    u64 start = rdtsc();
+    time_t begin = time();
+
+    for (size_t i = 0; i < SPAWN_COUNT; ++i)
+    {
+        u64 now = rdtsc();
+        pid_t pid = create_child(type);
+        create_cycles += (u32)(rdtsc() - now);
+        waitpid(pid, &status);
+    }
+
+    u32 total = (u32)(rdtsc() - start);
+    time_t seconds = time() - begin;
+
+    printf("%-6s create %d cycles, create + wait %d cycles",
+           bench_name[type], create_cycles / SPAWN_COUNT, total / SPAWN_COUNT);
+    if (seconds)
+        printf(", %d per second", SPAWN_COUNT / seconds);
+    printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && !strcmp(argv[1], "-c"))
+        return 0;
+
+    bench(BENCH_FORK);
+    bench(BENCH_VFORK);
+    bench(BENCH_SPAWN);
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/memory.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 同时运行的进程使用的内存超过物理内存，每个进程写满自己的堆之后反复校验
+// 内存不足时页面被换出到交换分区，缺页时再读回来，内容应该保持不变
+
+#define TASK_COUNT 6
+#define CHECK_ROUNDS 3
+
+// 链接器给出的程序结束地址
+extern char end[];
+
+// 每个字的内容由进程序号与地址决定
+static u32 pattern(u32 nr, u32 addr)
+{
+    return (nr << 24) ^ addr;
+}
+
+static int child(u32 nr, u32 size)
+{
+    u32 heap = ((u32)end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    u32 heap_end = heap + size * 0x100000;
+    if (brk((void*)heap_end) < 0)
+    {
+        printf("task %d brk %dM failed\n", nr, size);
+        return EOF;
+    }
+
+    for (u32 addr = heap; addr < heap_end; addr += sizeof(u32))
+        *(u32*)addr = pattern(nr, addr);
+
+    // 让出处理器，其他进程写内存时把这里的页面换出
+    for (size_t round = 0; round < CHECK_ROUNDS; round++)
+    {
+        yield();
+        for (u32 addr = heap; addr < heap_end; addr += sizeof(u32))
+        {
+            if (*(u32*)addr != pattern(nr, addr))
+            {
+                printf("task %d round %d wrong at 0x%p\n", nr, round, addr);
+                return EOF;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // 进程数量与每个进程的堆大小，单位 M，默认 6 个进程各 4M
+    u32 count = TASK_COUNT;
+    u32 size = 4;
+    if (argc > 1)
+        count = atoi(argv[1]);
+    if (argc > 2)
+        size = atoi(argv[2]);
+
+    u64 start = rdtsc();
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+            exit(child(i + 1, size));
+    }
+
+    u32 failed = 0;
+    for (u32 i = 0; i < count; ++i)
+    {
+        int32 status;
+        waitpid(-1, &status);
+        if (status)
+            failed++;
+    }
+
+    u32 cycles = (u32)(rdtsc() - start);
+    printf("swap test: %d tasks %dM each, %d failed, %u cycles\n",
+           count, size, failed, cycles);
+    return failed ? EOF : 0;
+}
@@ -0,0 +1,58 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 测量两个进程通过管道来回传递一个字节时，进程切换的耗时
+// 每一轮两次切换，每次都要切换页目录
+
+#define ROUND_COUNT 1000
+
+int main(int argc, char* argv[])
+{
+    u32 rounds = ROUND_COUNT;
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+
+    fd_t ping[2];
+    fd_t pong[2];
+    if (pipe(ping) < 0 || pipe(pong) < 0)
+    {
+        printf("pipe failed\n");
+        return EOF;
+    }
+
+    char ch = 0;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // 子进程把收到的字节送回去
+        for (u32 i = 0; i < rounds; ++i)
+        {
+            read(ping[0], &ch, 1);
+            write(pong[1], &ch, 1);
+        }
+        exit(0);
+    }
+
+    u64 start = rdtsc();
+    for (u32 i = 0; i < rounds; ++i)
+    {
+        write(ping[1], &ch, 1);
+        read(pong[0], &ch, 1);
+    }
+    u32 cycles = (u32)(rdtsc() - start);
+
+    int32 status;
+    waitpid(pid, &status);
+
+    printf("context switch: %u rounds, %u cycles/round, %u cycles/switch\n",
+           rounds, cycles / rounds, cycles / rounds / 2);
+
+    close(ping[0]);
+    close(ping[1]);
+    close(pong[0]);
+    close(pong[1]);
+    return 0;
+}
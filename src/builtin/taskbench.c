@@ -0,0 +1,57 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 同时存在大量进程时 fork 与 waitpid 的耗时
+// 子进程睡眠一段时间后退出，父进程等它们都退出之后，按创建的相反顺序回收
+// 每个进程占用 4 个内核页与若干用户页，默认数量要放得下默认的 32M 内存
+
+#define TASK_COUNT 200
+#define TASK_MAX 4000
+#define SLEEP_MS 1000
+
+static pid_t pids[TASK_MAX];
+
+int main(int argc, char* argv[])
+{
+    // 子进程数量，默认 200，内存不够时 fork 失败，只测量已经创建的进程
+    u32 count = TASK_COUNT;
+    if (argc > 1)
+        count = MIN(atoi(argv[1]), TASK_MAX);
+
+    u64 start = rdtsc();
+    u32 created = 0;
+    for (; created < count; ++created)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            sleep(SLEEP_MS);
+            exit(0);
+        }
+        if (pid < 0)
+            break;
+        pids[created] = pid;
+    }
+    u32 fork_cycles = (u32)(rdtsc() - start);
+
+    if (created < count)
+        printf("fork failed after %u tasks\n", created);
+    if (!created)
+        return EOF;
+
+    // 等所有子进程都退出，回收的时间不包括睡眠
+    sleep(SLEEP_MS * 2);
+
+    start = rdtsc();
+    int32 status;
+    for (int i = created - 1; i >= 0; --i)
+        waitpid(pids[i], &status);
+    u32 wait_cycles = (u32)(rdtsc() - start);
+
+    printf("%u tasks: fork %u cycles/task, waitpid %u cycles/task\n",
+           created, fork_cycles / created, wait_cycles / created);
+    return 0;
+}
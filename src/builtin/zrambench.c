@@ -0,0 +1,117 @@
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/device.h>
+#include <onix/memory.h>
+#include <onix/zram.h>
+#include <onix/fs.h>
+#include <onix/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 在压缩内存盘上建立文件系统，写入再读回一个文件
+// 输出读写的耗时、压缩率与内核压缩解压的吞吐量
+
+#define ZRAM_DEVICE "/dev/zram0"
+#define ZRAM_MOUNT "/zram"
+#define BENCH_FILE "/zram/zram.dat"
+
+static char buf[PAGE_SIZE];
+
+// 第 idx 页的内容：全 0 的页、类似文本的页与随机的页
+static void fill_page(u32 idx)
+{
+    switch (idx % 4)
+    {
+    case 0:
+        memset(buf, 0, PAGE_SIZE);
+        break;
+    case 3:
+        for (size_t i = 0; i < PAGE_SIZE; i++)
+            buf[i] = rand();
+        break;
+    default:
+        for (size_t i = 0; i < PAGE_SIZE; i += 32)
+            sprintf(buf + i, "line %8d of page %8d\n", i / 32, idx);
+        break;
+    }
+}
+
+// 每千个时钟周期处理的字节数
+static u32 bytes_per_kcycle(u32 bytes, u64 cycles)
+{
+    u32 kcycles = (u32)(cycles >> 10);
+    return kcycles ? bytes / kcycles : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // 文件大小，单位 K，默认 1M
+    u32 size = 1024;
+    if (argc > 1)
+        size = atoi(argv[1]);
+    u32 pages = size * 1024 / PAGE_SIZE;
+
+    if (mkfs(ZRAM_DEVICE, 0) < 0)
+    {
+        printf("mkfs %s failed\n", ZRAM_DEVICE);
+        return EOF;
+    }
+    mkdir(ZRAM_MOUNT, 0755);
+    if (mount(ZRAM_DEVICE, ZRAM_MOUNT, 0) < 0)
+    {
+        printf("mount %s failed\n", ZRAM_DEVICE);
+        return EOF;
+    }
+
+    fd_t fd = open(BENCH_FILE, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == EOF)
+    {
+        printf("open %s failed\n", BENCH_FILE);
+        return EOF;
+    }
+
+    u64 start = rdtsc();
+    for (u32 i = 0; i < pages; ++i)
+    {
+        fill_page(i);
+        write(fd, buf, PAGE_SIZE);
+    }
+    u32 write_cycles = (u32)(rdtsc() - start);
+
+    // 关闭之后页缓存被释放，再次打开时从压缩内存盘读取
+    close(fd);
+    fd = open(BENCH_FILE, O_RDONLY, 0);
+    start = rdtsc();
+    u32 sum = 0;
+    for (u32 i = 0; i < pages; ++i)
+    {
+        read(fd, buf, PAGE_SIZE);
+        sum += buf[PAGE_SIZE - 1];
+    }
+    u32 read_cycles = (u32)(rdtsc() - start);
+    close(fd);
+
+    zram_stat_t stat;
+    fd_t dev = open(ZRAM_DEVICE, O_RDONLY, 0);
+    ioctl(dev, DEV_CMD_ZRAM_STAT, &stat);
+    close(dev);
+
+    u32 orig = stat.orig_size >> 10;
+    u32 compr = MAX(stat.compr_size >> 10, 1);
+    u32 ratio = orig * 100 / compr;
+
+    printf("file %uK: write %u read %u cycles/page\n",
+           size, write_cycles / pages, read_cycles / pages);
+    printf("zram: %uK compressed to %uK ratio %u.%02u, same blocks %u, huge blocks %u, pages %u\n",
+           orig, compr, ratio / 100, ratio % 100, stat.same_blocks, stat.huge_blocks, stat.pages);
+    printf("zram: compress %u decompress %u bytes/kcycle\n",
+           bytes_per_kcycle(stat.write_bytes, stat.write_cycles),
+           bytes_per_kcycle(stat.read_bytes, stat.read_cycles));
+    printf("zram: memory limit %u pages, failed writes %u\n",
+           stat.mem_limit, stat.failed_writes);
+
+    unlink(BENCH_FILE);
+    umount(ZRAM_MOUNT);
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include <ds/bitmap.h>
 #include <string.h>
 #include <onix/assert.h>
+#include <stdlib.h>
 
 // 构造位图
 void bitmap_make(bitmap_t *map, char *bits, u32 length, u32 offset)
@@ -8,6 +9,7 @@ void bitmap_make(bitmap_t *map, char *bits, u32 length, u32 offset)
     map->bits = bits;
     map->length = length;
     map->offset = offset;
+    map->next = 0;
 }
 
 // 初始化位图
@@ -56,60 +58,127 @@ void bitmap_set(bitmap_t *map, u32 index, bool value)
         map->bits[bytes] |= (1 << bits);
     else 
         map->bits[bytes] &= ~(1 << bits);
+
+    // 释放了扫描起点之前的位，下次从这里开始
+    if (!value && idx < map->next)
+        map->next = idx;
 }
 
+// 取位图的第 widx 个 32 位字，超出长度的部分视为已占用
+static u32 bitmap_word(bitmap_t *map, u32 widx)
+{
+    u32 bytes = widx * 4;
+    if (bytes + 4 <= map->length)
+        return ((u32 *)map->bits)[widx];
 
-// 从位图中得到连续的 count 位
-int bitmap_scan(bitmap_t *map, u32 count)
+    u32 word = 0xffffffff;
+    for (size_t i = 0; bytes + i < map->length; i++)
+    {
+        word &= ~(0xff << (i * 8));
+        word |= (u8)map->bits[bytes + i] << (i * 8);
+    }
+    return word;
+}
+
+// 在 [start, end) 位之间查找连续 count 个 0，返回起始位，找不到返回 EOF
+static int bitmap_find(bitmap_t *map, u32 start, u32 end, u32 count)
 {
-    // 标记目标开始的位置
-    int start = EOF;
-    // 剩余的位数
-    u32 bits_left = map->length * 8;
-    // 下一个位
-    u32 next_bit = 0;
-    // 计数器
-    u32 counter = 0;
+    // 当前连续 0 的开始位置与长度
+    u32 run_start = start;
+    u32 run_len = 0;
 
-    // 从头开始找
-    while (bits_left-- > 0)
+    for (u32 widx = start / 32; widx * 32 < end; widx++)
     {
-        if (!bitmap_test(map, map->offset + next_bit))
-            // 如果下一个位没有占用，则计数器加一
-            counter++;
-        else
-            // 否则计数器置为 0，继续寻找
-            counter = 0;
+        u32 word = bitmap_word(map, widx);
+        u32 base = widx * 32;
 
-        // 下一位，位置加一
-        next_bit++;
+        // 第一个字中 start 之前的位视为已占用
+        if (base < start)
+            word |= (1 << (start - base)) - 1;
 
-        // 找到数量一致，则设置开始的位置，结束
-        if (counter == count)
+        // 整个字都被占用，直接跳过
+        if (word == 0xffffffff)
         {
-            start = next_bit - count;
-            break;
+            run_len = 0;
+            continue;
+        }
+
+        // 整个字都空闲
+        if (word == 0)
+        {
+            if (!run_len)
+                run_start = base;
+            run_len += 32;
+        }
+        else
+        {
+            u32 pos = 0;
+            while (pos < 32)
+            {
+                // 跳过已占用的位
+                u32 bits = ~word >> pos;
+                if (!bits)
+                {
+                    run_len = 0;
+                    break;
+                }
+                u32 skip = bit_first(bits);
+                if (skip)
+                    run_len = 0;
+                pos += skip;
+
+                // 连续空闲位的长度
+                bits = word >> pos;
+                u32 len = bits ? bit_first(bits) : 32 - pos;
+                if (!run_len)
+                    run_start = base + pos;
+                run_len += len;
+                pos += len;
+
+                if (run_len >= count)
+                    break;
+            }
         }
+
+        if (run_len >= count)
+            break;
     }
 
+    if (run_len < count || run_start + count > end)
+        return EOF;
+    return run_start;
+}
+
+// 从位图中得到连续的 count 位
+int bitmap_scan(bitmap_t *map, u32 count)
+{
+    assert(count > 0);
+    u32 total = map->length * 8;
+
+    // 先从上次结束的位置开始找，找不到再从头开始
+    int start = EOF;
+    if (map->next < total)
+        start = bitmap_find(map, map->next, total, count);
+    if (start == EOF && map->next)
+        start = bitmap_find(map, 0, MIN(total, map->next + count - 1), count);
+
     // 如果没找到，则返回 EOF(END OF FILE)
     if (start == EOF)
         return EOF;
 
     // 否则将找到的位，全部置为 1
-    bits_left = count;
-    next_bit = start;
-    while (bits_left--)
-    {
-        bitmap_set(map, map->offset + next_bit, true);
-        next_bit++;
-    }
+    for (u32 bit = start; bit < start + count; bit++)
+        map->bits[bit / 8] |= (1 << (bit % 8));
+
+    map->next = start + count;
 
     // 然后返回索引
     return start + map->offset;
 }
 
 #include <onix/debug.h>
+#include <onix/memory.h>
+#include <onix/io.h>
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
@@ -131,4 +200,140 @@ void bitmap_tests()
         }
         LOGK("%d\n", idx);
     }
-}
\ No newline at end of file
+}
+
+// 原来逐位测试的扫描方法，用于对比
+static int bitmap_scan_bits(bitmap_t *map, u32 count)
+{
+    int start = EOF;
+    u32 bits_left = map->length * 8;
+    u32 next_bit = 0;
+    u32 counter = 0;
+
+    while (bits_left-- > 0)
+    {
+        if (!bitmap_test(map, map->offset + next_bit))
+            counter++;
+        else
+            counter = 0;
+        next_bit++;
+        if (counter == count)
+        {
+            start = next_bit - count;
+            break;
+        }
+    }
+
+    if (start == EOF)
+        return EOF;
+
+    for (u32 i = start; i < start + count; i++)
+        bitmap_set(map, map->offset + i, true);
+    return start + map->offset;
+}
+
+#define BENCH_BYTES 0x2000 // 8K 的位图，与文件系统块位图一样大
+#define BENCH_LOOP 16
+
+typedef int (*bitmap_scan_t)(bitmap_t *map, u32 count);
+
+// 按照 pattern 构造位图，period 位为一个周期，其中前 used 位被占用
+static void bench_fill(bitmap_t *map, u32 period, u32 used)
+{
+    memset(map->bits, 0, map->length);
+    map->next = 0;
+    for (u32 i = 0; i < map->length * 8; i++)
+    {
+        if (i % period < used)
+            map->bits[i / 8] |= (1 << (i % 8));
+    }
+}
+
+// 反复扫描并释放，返回平均每次扫描的时钟周期
+static u32 bench_run(bitmap_t *map, bitmap_scan_t scan, u32 count, bool hint)
+{
+    u64 total = 0;
+    for (size_t i = 0; i < BENCH_LOOP; i++)
+    {
+        if (!hint)
+            map->next = 0;
+
+        u64 start = rdtsc();
+        int idx = scan(map, count);
+        total += rdtsc() - start;
+
+        if (idx == EOF)
+            continue;
+        for (u32 bit = idx; bit < idx + count; bit++)
+            map->bits[bit / 8] &= ~(1 << (bit % 8));
+
+        // 释放后依旧从后面开始，模拟分配后一直占用
+        if (hint)
+            map->next = idx + count;
+    }
+    return (u32)(total / BENCH_LOOP);
+}
+
+static void bench_case(bitmap_t *map, char *name, u32 period, u32 used, u32 count)
+{
+    bench_fill(map, period, used);
+    u32 old = bench_run(map, bitmap_scan_bits, count, false);
+    bench_fill(map, period, used);
+    u32 word = bench_run(map, bitmap_scan, count, false);
+    bench_fill(map, period, used);
+    u32 hint = bench_run(map, bitmap_scan, count, true);
+    LOGK("bitmap bench %-10s count %d old %d word %d hint %d cycles\n",
+         name, count, old, word, hint);
+}
+
+// 逐位扫描与按字扫描的对比
+void bitmap_bench()
+{
+    bitmap_t map;
+    char *bits = (char *)alloc_kpage(BENCH_BYTES / PAGE_SIZE);
+    bitmap_init(&map, bits, BENCH_BYTES, 0);
+
+    // 只有最后一位空闲
+    bench_case(&map, "full", BENCH_BYTES * 8, BENCH_BYTES * 8 - 1, 1);
+    // 每 64 位占用一位
+    bench_case(&map, "sparse", 64, 1, 1);
+    bench_case(&map, "sparse", 64, 1, 16);
+    // 每 5 位中占用 3 位，找不到 4 位的连续空间
+    bench_case(&map, "fragment", 5, 3, 2);
+    bench_case(&map, "fragment", 5, 3, 4);
+
+    free_kpage((u32)bits, BENCH_BYTES / PAGE_SIZE);
+}
+
+// 与逐位扫描的结果对比，内核页的内容是任意的，两个位图都要清零
+void bitmap_check()
+{
+    bitmap_t map1, map2;
+    char *bits = (char *)alloc_kpage(2);
+    bitmap_init(&map1, bits, 500, 100);
+    bitmap_init(&map2, bits + PAGE_SIZE, 500, 100);
+
+    srand(1);
+    for (size_t i = 0; i < 2000; i++)
+    {
+        u32 count = rand() % 40 + 1;
+        if (rand() & 1)
+        {
+            // 两边从头开始的首次适配结果一定一样
+            map1.next = 0;
+            int idx1 = bitmap_scan(&map1, count);
+            int idx2 = bitmap_scan_bits(&map2, count);
+            assert(idx1 == idx2);
+        }
+        else
+        {
+            u32 bit = 100 + rand() % (500 * 8);
+            bitmap_set(&map1, bit, false);
+            bitmap_set(&map2, bit, false);
+        }
+    }
+    assert(!memcmp(bits, bits + PAGE_SIZE, 500));
+
+    free_kpage((u32)bits, 2);
+    LOGK("bitmap check finish...\n");
+}
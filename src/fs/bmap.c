@@ -87,7 +87,7 @@ idx_t ialloc(dev_t dev)
         assert(buf);
 
         // 位图的第 0 号 bit 位对应第 BLOCK_BITS * i 号 inode
-        bitmap_make(&map, buf->data, BLOCK_BITS, i * BLOCK_BITS);
+        bitmap_make(&map, buf->data, BLOCK_SIZE, i * BLOCK_BITS);
         bit = bitmap_scan(&map, 1);
         if (bit != EOF)
         {
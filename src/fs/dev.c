@@ -56,6 +56,16 @@ void dev_init()
         mknod(name, IFBLK | 0600, device->dev);
     }
 
+    // 初始化压缩内存盘，可读可写
+    for (size_t i = 0; true; i++)
+    {
+        device = device_find(DEV_ZRAM, i);
+        if (!device)
+            break;
+        sprintf(name, "/dev/%s", device->name);
+        mknod(name, IFBLK | 0600, device->dev);
+    }
+
     // 初始化块设备，可读可写
     for (size_t i = 0; true; ++i)
     {
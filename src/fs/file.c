@@ -5,31 +5,40 @@
 #include <onix/stat.h>
 #include <onix/types.h>
 #include <onix/syscall.h>
+#include <onix/slab.h>
 
-#define FILE_NR 128
+// 标准输入、输出、错误三个文件
+#define FILE_STD_NR 3
 
-file_t file_table[FILE_NR];
+file_t file_table[FILE_STD_NR];
+
+// 文件结构体缓存
+static kmem_cache_t* file_cache;
 
 file_t* get_file()
 {
-    for (size_t i = 0; i < FILE_NR; ++i)
-    {
-        file_t* file = file_table + i;
-        if (!(file->count))
-        {
-            file->count++;
-            return file;
-        }
-    }
-    panic("Exceed max open files!!!");
+    file_t* file = kmem_cache_alloc(file_cache);
+    file->inode = NULL;
+    file->count = 1;
+    file->offset = 0;
+    file->flags = 0;
+    file->mode = 0;
+    return file;
 }
 
 void put_file(file_t* file)
 {
     assert(file->count > 0);
     file->count--;
-    if (!(file->count))
-        iput(file->inode);
+    if (file->count)
+        return;
+
+    iput(file->inode);
+
+    // 标准输入输出文件是静态的
+    if (file >= file_table && file < file_table + FILE_STD_NR)
+        return;
+    kmem_cache_free(file_cache, file);
 }
 
 fd_t sys_open(char* filename, int flags, int mode)
@@ -189,6 +198,27 @@ u32 sys_write(fd_t fd, char* buf, u32 count)
     return len;
 }
 
+// 控制设备文件对应的设备，args 的含义由命令决定
+int sys_ioctl(fd_t fd, int cmd, void* args)
+{
+    if (fd < 0 || fd >= TASK_FILE_NR)
+        return EOF;
+
+    task_t* task = running_task();
+    file_t* file = task->files[fd];
+    if (!file)
+        return EOF;
+
+    inode_t* inode = file->inode;
+    if (!ISCHR(inode->desc->mode) && !ISBLK(inode->desc->mode))
+        return EOF;
+
+    // mknod 可以创建任意设备号的设备文件
+    if (!inode->desc->zone[0])
+        return EOF;
+    return device_ioctl(inode->desc->zone[0], cmd, args, 0);
+}
+
 int sys_lseek(fd_t fd, off_t offset, int whence)
 {
     assert(fd < TASK_FILE_NR);
@@ -267,13 +297,5 @@ fd_t sys_dup2(fd_t oldfd, fd_t newfd)
 
 void file_init()
 {
-    for (size_t i = 3; i < FILE_NR; ++i)
-    {
-        file_t* file = file_table + i;
-        file->count = 0;
-        file->mode = 0;
-        file->flags = 0;
-        file->offset = 0;
-        file->inode = NULL;
-    }
+    file_cache = kmem_cache_create("file", sizeof(file_t), NULL);
 }
\ No newline at end of file
@@ -8,37 +8,52 @@
 #include <onix/arena.h>
 #include <ds/fifo.h>
 #include <onix/memory.h>
+#include <onix/slab.h>
+#include <onix/pcache.h>
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
-#define INODE_NR 64
-
 #define MIN(x, y) (x < y ? x : y)
 
-// 保存 inode_t 结构体
-// 系统中可能存在多个文件系统，每个文件系统的 super 会记录自己的 inode，但所有的 inode 都会保存在这个数组
-static inode_t inode_table[INODE_NR];
+// 根目录的 inode 是静态的，进程创建时文件系统还没有挂载，需要提前引用
+static inode_t inode_root;
+
+// 其他 inode_t 结构体都从缓存中分配
+static kmem_cache_t* inode_cache;
+
+// 未使用 inode 最多的数量，每个都持有 inode 描述符所在的缓冲
+#define INODE_UNUSED_MAX 64
+
+// 引用计数为 0 但还有缓存页的文件 inode，头部是最近释放的
+// 再次打开时页缓存还在，缓存页都被淘汰之后才释放
+static list_t inode_unused;
+static u32 inode_unused_count;
 
 // 申请一个 inode 结构体空间
 static inode_t* get_free_inode_struct()
 {
-    for (size_t i = 0; i < INODE_NR; ++i)
+    // 第一个申请的 inode 是根目录
+    if (inode_root.dev == EOF)
     {
-        inode_t* inode = inode_table + i;
-        // 找到第一个 设备为 EOF 的结构体
-        if (inode->dev == EOF)
-            return inode;
+        list_init(&(inode_root.pages));
+        return &inode_root;
     }
-    panic("no more inode!!!");
+
+    inode_t* inode = kmem_cache_alloc(inode_cache);
+    memset(inode, 0, sizeof(inode_t));
+    inode->dev = EOF;
+    list_init(&(inode->pages));
+    return inode;
 }
 
 // 释放一个 inode 结构体空间
 static void put_free_inode_struct(inode_t* inode)
 {
-    assert(inode != inode_table);
+    assert(inode != &inode_root);
     assert(inode->count == 0);
     // 将 inode 的设备设置为 EOF
     inode->dev = EOF;
+    kmem_cache_free(inode_cache, inode);
 }
 
 // 计算 nr 号的 inode 在哪个块（磁盘逻辑块号）
@@ -110,7 +125,7 @@ static inode_t* find_exist_inode(dev_t dev, idx_t nr)
 // 获取根目录的 inode
 inode_t* get_root_inode()
 {
-    return inode_table;
+    return &inode_root;
 }
 
 extern time_t time();
@@ -137,6 +152,13 @@ inode_t* iget(dev_t dev, idx_t nr)
     inode_t* inode = find_exist_inode(dev, nr);
     if (inode)
     {
+        // 没有引用的 inode 重新被使用，从未使用链表中去掉
+        if (!inode->count)
+        {
+            list_remove(&(inode->lru_node));
+            inode_unused_count--;
+        }
+
         // 找到了，引用计数增加，更新访问时间为当前
         inode->count++;
         inode->atime = time();
@@ -192,6 +214,46 @@ inode_t* new_inode(dev_t dev, idx_t nr)
     return inode;
 }
 
+// 释放没有引用的 inode，以及缓存的文件内容与 inode 缓冲
+static void inode_release(inode_t* inode)
+{
+    assert(!inode->count);
+
+    if (inode->lru_node.next)
+    {
+        list_remove(&(inode->lru_node));
+        inode_unused_count--;
+    }
+
+    // 先从设备的 inode 链表移除，写回缓冲可能阻塞，期间不能再被 iget 找到
+    list_remove(&(inode->node));
+
+    pcache_free(inode);
+    brelse(inode->buf);
+
+    // 释放 inode 内存
+    put_free_inode_struct(inode);
+}
+
+void inode_pages_empty(inode_t* inode)
+{
+    // 在未使用链表中，说明没有引用，也不在 inode_release 中
+    if (!inode->count && inode->lru_node.next)
+        inode_release(inode);
+}
+
+void inode_prune(dev_t dev)
+{
+    list_node_t* node = inode_unused.head.next;
+    while (node != &(inode_unused.tail))
+    {
+        inode_t* inode = element_entry(inode_t, lru_node, node);
+        node = node->next;
+        if (inode->dev == dev)
+            inode_release(inode);
+    }
+}
+
 // 释放 inode
 void iput(inode_t* inode)
 {
@@ -212,14 +274,23 @@ void iput(inode_t* inode)
     if (inode->count)
         return;
 
-    // 引用计数为 0，释放 inode 缓冲
-    brelse(inode->buf);
+    // 还有缓存页的文件先留着，再次打开时不用重新读取
+    if (ISFILE(inode->desc->mode) && inode->desc->nlinks && !list_empty(&(inode->pages)))
+    {
+        list_push(&inode_unused, &(inode->lru_node));
+        inode_unused_count++;
 
-    // 链表移除
-    list_remove(&(inode->node));
+        // 太多了就释放最久没有使用的
+        if (inode_unused_count > INODE_UNUSED_MAX)
+        {
+            list_node_t* node = inode_unused.tail.prve;
+            inode_release(element_entry(inode_t, lru_node, node));
+        }
+        return;
+    }
 
-    // 释放 inode 内存
-    put_free_inode_struct(inode);
+    // 引用计数为 0，释放缓存的文件内容与 inode 缓冲
+    inode_release(inode);
 }
 
 // 获取 inode 第 block 块索引，如果不存在，并且 create 为 true 则创建
@@ -305,6 +376,28 @@ int inode_read(inode_t *inode, char *buf, u32 len, off_t offset)
 
     // 剩余字节数量
     u32 left = MIN(len, inode->desc->size - offset);
+
+    // 普通文件的内容从页缓存读取
+    while (ISFILE(inode->desc->mode) && left)
+    {
+        page_t* page = pcache_get(inode, offset / PAGE_SIZE);
+
+        // 文件在页中的偏移量
+        u32 start = offset % PAGE_SIZE;
+
+        // 本次需要读取的字节数
+        u32 chars = MIN(PAGE_SIZE - start, left);
+
+        offset += chars;
+        left -= chars;
+
+        pcache_read(page, buf, start, chars);
+        buf += chars;
+
+        pcache_put(page);
+    }
+
+    // 目录的内容与 namei 一样经过高速缓冲
     while (left)
     {
         // 找到对应的文件
@@ -356,21 +449,21 @@ int inode_write(inode_t *inode, char *buf, u32 len, off_t offset)
     u32 left = len;
     while (left)
     {
-        // 找到对应的文件，不存在就创建
-        idx_t nr = bmap(inode, offset / BLOCK_SIZE, true);
-        assert(nr);
+        // 读入文件所在的页，映射了这一页的进程也能看到写入的内容
+        page_t* page = pcache_get(inode, offset / PAGE_SIZE);
 
-        // 读入文件块
-        buffer_t* bf = bread(inode->dev, nr);
-        bf->dirty = true;
+        // 文件在页中的偏移量
+        u32 start = offset % PAGE_SIZE;
 
-        // 文件在逻辑块中的偏移量
-        u32 start = offset % BLOCK_SIZE;
-        // 文件逻辑块指针
-        char* ptr = bf->data + start;
+        // 本次需要写入的字节数
+        u32 chars = MIN(PAGE_SIZE - start, left);
 
-        // 本次需要读取的字节数
-        u32 chars = MIN(BLOCK_SIZE - start, left);
+        // 拷贝
+        pcache_write(page, buf, start, chars);
+
+        // 写入磁盘，文件块不存在就创建
+        pcache_flush(page, start, start + chars);
+        pcache_put(page);
 
         // 更新 偏移值 和 剩余字节数量
         offset += chars;
@@ -383,15 +476,9 @@ int inode_write(inode_t *inode, char *buf, u32 len, off_t offset)
             inode->buf->dirty = true;
         }
 
-        // 拷贝
-        memcpy(ptr, buf, chars);
-
         // 更新缓冲位置
         buf += chars;
-
-        // 释放文件块
-        brelse(bf);
-    } 
+    }
 
     // 更新访问时间
     inode->atime = time();
@@ -432,6 +519,8 @@ void inode_truncate(inode_t *inode)
     if (!ISFILE(inode->desc->mode) && !ISDIR(inode->desc->mode))
         return;
 
+    pcache_free(inode);
+
     // 释放直接块
     for (size_t i = 0; i < DIRECT_BLOCK; ++i)
     {
@@ -456,9 +545,7 @@ void inode_truncate(inode_t *inode)
 
 void inode_init()
 {
-    for (size_t i = 0; i < INODE_NR; ++i)
-    {
-        inode_t* inode = inode_table + i;
-        inode->dev = EOF;
-    }
+    inode_root.dev = EOF;
+    list_init(&inode_unused);
+    inode_cache = kmem_cache_create("inode", sizeof(inode_t), NULL);
 }
\ No newline at end of file
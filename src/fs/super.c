@@ -238,6 +238,8 @@ int sys_umount(char *target)
         LOGK("warning super block mount = 0\n");
     }
 
+    // 没有引用的 inode 只是为了保留页缓存，先释放掉
+    inode_prune(sb->dev);
     if (list_size(&sb->inode_list) > 1)
         goto rollback;
 
@@ -8,6 +8,7 @@ typedef struct bitmap_t
     u8 *bits;   // 位图缓冲区
     u32 length; // 位图缓冲区长度
     u32 offset; // 位图开始的偏移
+    u32 next;   // 下次扫描开始的位，相对于 offset
 } bitmap_t;
 
 // 初始化位图
@@ -25,4 +26,20 @@ void bitmap_set(bitmap_t *map, u32 index, bool value);
 // 从位图中得到连续的 count 位
 int bitmap_scan(bitmap_t *map, u32 count);
 
+// 得到 value 最低位的 1 的位置，value 不能为 0
+static _inline u32 bit_first(u32 value)
+{
+    u32 idx;
+    asm volatile("bsfl %1, %0\n" : "=r"(idx) : "rm"(value));
+    return idx;
+}
+
+// 得到 value 最高位的 1 的位置，value 不能为 0
+static _inline u32 bit_last(u32 value)
+{
+    u32 idx;
+    asm volatile("bsrl %1, %0\n" : "=r"(idx) : "rm"(value));
+    return idx;
+}
+
 #endif
\ No newline at end of file
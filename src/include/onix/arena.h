@@ -4,17 +4,26 @@
 #include <onix/types.h>
 #include <ds/list.h>
 
-#define DESC_COUNT 7
+// 16、32、64 ... 4096 字节，共 9 种大小
+#define DESC_COUNT 9
 
-// 把每个空闲块的起始作为 list_node_t 结构体链接起来
-typedef list_node_t block_t;
+// 最大的块，超过的直接按页分配
+#define ARENA_MAX_BLOCK 4096
+
+// 每个 arena 内部用单链表把空闲块链接起来
+typedef struct block_t
+{
+    struct block_t* next;
+} block_t;
 
 // 内存描述符
 typedef struct arena_descriptor_t
 {
-    u32 total_block;    // 一页内存分成了多少快
+    u32 total_block;    // 一个 arena 分成了多少块
     u32 block_size;     // 块大小
-    list_t free_list;   // 空闲列表
+    u32 pages;          // 一个 arena 占用的页数
+    list_t arena_list;  // 还有空闲块的 arena 链表
+    u32 empty_count;    // 全部空闲的 arena 数量
 } arena_descriptor_t;
 
 // 描述一页或多页内存的分配情况
@@ -22,11 +31,14 @@ typedef struct arena_t
 {
     arena_descriptor_t* desc;   // 该 arena 的描述符
     u32 count;                  // 当前剩余多少块，或页数
-    u32 large;                  // 表示是不是超过了 1024 字节
+    u32 large;                  // 表示是不是超过了最大的块
+    block_t* free;              // 空闲块链表
+    list_node_t node;           // 描述符链表节点
     u32 magic;                  // 魔数
 } arena_t;
 
 void* kmalloc(size_t size);
 void kfree(void* ptr);
+void* krealloc(void* ptr, size_t size);
 
-#endif
\ No newline at end of file
+#endif
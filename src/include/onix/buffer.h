@@ -30,4 +30,7 @@ buffer_t* bread(dev_t dev, idx_t block);
 void bwrite(buffer_t* bf);
 void brelse(buffer_t* bf);
 
+// 内核内存不足时，释放至多 count 页空闲的缓冲，返回释放的页数
+u32 buffer_shrink(u32 count);
+
 #endif
\ No newline at end of file
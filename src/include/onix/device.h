@@ -23,6 +23,7 @@ enum device_subtype_t
     DEV_IDE_DISK,       // IDE 磁盘
     DEV_IDE_PART,       // IDE 磁盘分区
     DEV_RAMDISK,        // 虚拟磁盘
+    DEV_ZRAM,           // 压缩内存盘
 };
 
 // 设备控制命令
@@ -30,8 +31,19 @@ enum device_cmd_t
 {
     DEV_CMD_SECTOR_START = 1, // 获得设备扇区开始位置 lba
     DEV_CMD_SECTOR_COUNT,     // 获得设备扇区数量
+    DEV_CMD_PART_SYSTEM,      // 获得分区类型
+    DEV_CMD_ZRAM_STAT,        // 获得压缩内存盘的统计信息
+    DEV_CMD_DISCARD,          // 丢弃 dev_range_t 范围的扇区，之后读为 0，释放占用的内存
+    DEV_CMD_RAMDISK_CREATE,   // 创建参数大小的虚拟磁盘，返回设备号
 };
 
+// 块设备的扇区范围
+typedef struct dev_range_t
+{
+    idx_t start;    // 开始的扇区
+    u32 count;      // 扇区数量
+} dev_range_t;
+
 #define REQ_READ 0  // 块设备读
 #define REQ_WRITE 1 // 块设备写
 
@@ -91,7 +103,7 @@ int device_read(dev_t dev, void* buf, size_t count, idx_t idx, int flags);
 // 写设备
 int device_write(dev_t dev, void* buf, size_t count, idx_t idx, int flags);
 
-// 块设备请求，向 dev 号设备发起 type 类型的请求
-void device_request(dev_t dev, void *buf, u8 count, idx_t idx, int flags, u32 type);
+// 块设备请求，向 dev 号设备发起 type 类型的请求，设备读写失败返回 EOF
+int device_request(dev_t dev, void *buf, u8 count, idx_t idx, int flags, u32 type);
 
 #endif
\ No newline at end of file
@@ -83,6 +83,8 @@ typedef struct inode_t
     struct task_t* rxwaiter;// 读等待进程
     struct task_t* txwaiter;// 写等待进程
     bool pipe;              // 管道标志
+    list_t pages;           // 页缓存中的文件内容
+    list_node_t lru_node;   // 没有引用但还有缓存页时，在未使用 inode 链表中的节点
 } inode_t;
 
 typedef struct super_desc_t
@@ -167,6 +169,12 @@ inode_t* iget(dev_t dev, idx_t nr);
 // 释放 inode
 void iput(inode_t* inode);
 
+// inode 的缓存页都被淘汰了，没有引用的 inode 可以释放
+void inode_pages_empty(inode_t* inode);
+
+// 释放 dev 设备上没有引用但还有缓存页的 inode，卸载之前调用
+void inode_prune(dev_t dev);
+
 // 创建新的 inode 
 inode_t* new_inode(dev_t dev, idx_t nr);
 
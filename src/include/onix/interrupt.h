@@ -44,6 +44,7 @@ void send_eoi(int vector);
 // 设置中断处理函数
 void set_interrupt_handler(u32 irq, handler_t handler);
 void set_interrupt_mask(u32 irq, bool enable);
+bool interrupt_pending(u32 irq);
 
 bool interrupt_disable();             // 清除 IF 位，返回设置之前的值
 bool get_interrupt_state();           // 获得 IF 位
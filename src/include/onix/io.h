@@ -13,4 +13,12 @@ extern void outb(u16 port, u8 value);
 // 输出一个字
 extern void outw(u16 port, u16 value);
 
+// 读取时间戳计数器
+static _inline u64 rdtsc()
+{
+    u64 tsc;
+    asm volatile("rdtsc\n" : "=A"(tsc));
+    return tsc;
+}
+
 #endif
\ No newline at end of file
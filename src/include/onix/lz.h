@@ -0,0 +1,17 @@
+#ifndef __ONIX_LZ_HH__
+#define __ONIX_LZ_HH__
+
+#include <onix/types.h>
+
+// LZ77 族的快速压缩，格式与 LZ4 的块格式类似
+// 每个序列：标记字节（高 4 位字面量长度，低 4 位匹配长度 - 4），
+// 长度为 15 时后面跟着扩展长度字节，然后是字面量，最后是 2 字节的匹配偏移
+// 最后一个序列只有字面量，输入的长度不超过 64K
+
+// 压缩 src 的 len 个字节到 dst，结果超过 cap 时返回 EOF，否则返回压缩后的长度
+int lz_compress(u8* src, u32 len, u8* dst, u32 cap);
+
+// 解压 src 的 len 个字节到 dst，数据错误或超过 cap 时返回 EOF，否则返回解压后的长度
+int lz_decompress(u8* src, u32 len, u8* dst, u32 cap);
+
+#endif
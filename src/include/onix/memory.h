@@ -2,6 +2,7 @@
 #define __ONIX_MEMORY_HH__
 
 #include <onix/types.h>
+#include <ds/list.h>
 
 #define PAGE_SIZE 0x1000     // 一页的大小 4K
 #define MEMORY_BASE 0x100000 // 1M，可用内存开始的位置
@@ -9,18 +10,6 @@
 // 内核内存空间，16M
 #define KERNEL_MEMORY_SIZE 0x1000000
 
-// 内核缓存地址
-#define KERNEL_BUFFER_MEM 0x800000
-
-// 内核缓存大小
-#define KERNEL_BUFFER_SIZE 0x400000
-
-// 内存虚拟磁盘地址
-#define KERNEL_RAMDISK_MEM (KERNEL_BUFFER_MEM + KERNEL_BUFFER_SIZE)
-
-// 内存虚拟磁盘大小
-#define KERNEL_RAMDISK_SIZE 0x400000
-
 // 用户程序地址
 #define USER_EXEC_ADDR KERNEL_MEMORY_SIZE
 
@@ -42,6 +31,12 @@
 // 内核页目录索引
 #define KERNEL_PAGE_DIR 0x1000
 
+// 内核临时映射物理页的地址，页目录自映射之前的 4M，所有进程共用
+#define KMAP_ADDR 0xff800000
+
+// 临时映射的槽数量
+#define KMAP_NR 16
+
 typedef struct page_entry_t
 {
     u8 present : 1;  // 在内存中
@@ -59,6 +54,53 @@ typedef struct page_entry_t
     u32 index : 20;  // 页索引
 } _packed page_entry_t;
 
+struct inode_t;
+struct task_t;
+
+// 缺页时再分配的区域至多提前填充的页数，对齐到这么多页
+#define FAULT_AROUND_PAGES 4
+
+enum region_flag_t
+{
+    REGION_WRITE = 1,   // 区域可写
+    REGION_SHARED = 2,  // 共享映射，写入的内容写回文件
+};
+
+// 批量刷新快表时逐页刷新的上限，超过时重新加载 cr3
+#define TLB_GATHER_MAX 32
+
+// 多页操作中收集的快表刷新
+typedef struct tlb_gather_t
+{
+    u32 count;                  // 需要刷新的页数
+    u32 pages[TLB_GATHER_MAX];  // 需要刷新的页，超过上限之后不再记录
+} tlb_gather_t;
+
+// 内存管理的统计信息，通过 memory_stat 获得
+typedef struct memory_stat_t
+{
+    u32 zero_count;     // 清零池中的物理页数量
+    u32 zero_hits;      // 要求清零且池中有页的次数
+    u32 zero_misses;    // 要求清零但池为空，只能同步清零的次数
+    u32 kzero_count;    // 清零池中的内核页数量
+    u32 kzero_hits;     // 要求一页清零的内核页且池中有页的次数
+    u32 kzero_misses;   // 要求一页清零的内核页但池为空的次数
+    u32 tlb_invlpg;     // invlpg 刷新单页的次数
+    u32 tlb_full;       // 重新加载 cr3 整体刷新快表的次数
+} memory_stat_t;
+
+// 进程的文件映射区域，缺页时才从文件读取内容
+typedef struct vm_region_t
+{
+    u32 start;              // 开始地址，页对齐
+    u32 end;                // 结束地址，页对齐
+    u32 file_end;           // 小于这个地址的内容来自文件，之后的填充 0
+    u32 offset;             // start 在文件中的偏移
+    u32 flags;              // 区域标志
+    struct inode_t* inode;  // 映射的文件
+    list_node_t node;       // 进程区域链表节点，按开始地址排序
+} vm_region_t;
+
 // 获取 cr2 寄存器
 u32 get_cr2();
 
@@ -71,9 +113,31 @@ void set_cr3(u32 pde);
 // 分配 count 个连续的内核页
 u32 alloc_kpage(u32 page);
 
+// 分配 count 个连续的内核页，内核内存不足时返回 0
+u32 try_alloc_kpage(u32 page);
+
+// 分配 count 个清零的内核页，一页时优先使用空闲进程预先清零的页
+u32 alloc_kpage_zero(u32 count);
+
 // 释放 count 个连续的内核页
 void free_kpage(u32 vaddr, u32 count);
 
+// 分配一页物理内存，返回物理地址，内核通过 kmap 访问
+u32 alloc_page();
+
+// 释放物理页的一个引用，用户进程映射的页由最后一个引用释放
+void free_page(u32 paddr);
+
+// 物理页是否还被用户进程映射，即引用多于一个
+bool page_mapped(u32 paddr);
+
+// 将物理页 paddr 临时映射到内核，返回虚拟地址
+// 映射期间关中断，不能阻塞，按照栈的顺序 kunmap
+void* kmap(u32 paddr);
+
+// 释放最后一个 kmap 的映射
+void kunmap(void* vaddr);
+
 // 将 vaddr 映射物理内存
 void link_page(u32 vaddr);
 
@@ -81,7 +145,10 @@ void link_page(u32 vaddr);
 void unlink_page(u32 vaddr);
 
 // 拷贝页目录
-page_entry_t* copy_pde();
+void copy_pde(page_entry_t* pde);
+
+// 创建只有内核映射的页目录
+void create_pde(page_entry_t* pde);
 
 // 释放页目录
 void free_pde();
@@ -92,4 +159,45 @@ page_entry_t* get_entry(u32 vaddr, bool create);
 // 刷新快表
 void flush_tlb(u32 vaddr);
 
+// 收集多页操作中需要刷新的页，结束时统一刷新
+void tlb_gather_init(tlb_gather_t* tlb);
+void tlb_gather_add(tlb_gather_t* tlb, u32 vaddr);
+
+// 页数不超过 TLB_GATHER_MAX 时逐页 invlpg，否则重新加载 cr3
+void tlb_gather_flush(tlb_gather_t* tlb);
+
+// 文件映射区域缓存初始化，需要在 slab_init 之后
+void region_init();
+
+// 为当前进程添加文件映射区域
+void region_add(u32 start, u32 end, struct inode_t* inode, u32 offset, u32 file_end, u32 flags);
+
+// fork 的子进程复制 task 的文件映射区域
+void region_fork(struct task_t* task, struct task_t* child);
+
+// 释放进程所有的文件映射区域，共享映射的脏页写回文件
+void region_clear(struct task_t* task);
+
+
+// 输出伙伴系统每一阶的空闲块数量
+void buddy_info();
+
+// 输出内核虚拟页的碎片情况
+void kernel_extent_info();
+
+// 物理内存的总页数
+u32 memory_total_pages();
+
+// 物理内存的空闲页数，包括清零池中的页
+u32 memory_free_pages();
+
+// 内核空闲页的数量
+u32 kernel_free_page_count();
+
+// 空闲时清零一个内核页或物理页放入清零池，没有需要做的工作返回 false
+bool zero_pool_fill();
+
+// 输出页面回收与交换的统计信息
+void reclaim_info();
+
 #endif
\ No newline at end of file
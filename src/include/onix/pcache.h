@@ -0,0 +1,49 @@
+#ifndef __ONIX_PCACHE_HH__
+#define __ONIX_PCACHE_HH__
+
+#include <onix/types.h>
+#include <onix/mutex.h>
+#include <ds/list.h>
+
+struct inode_t;
+
+// page_t 结构体，描述普通文件的一页内容
+typedef struct page_t
+{
+    u32 paddr;              // 页面的物理地址，内核通过 kmap 访问，可以直接映射给用户进程
+    struct inode_t* inode;  // 所属文件
+    idx_t index;            // 文件中的页索引
+    int count;              // 引用计数
+    list_node_t hnode;      // 哈希表拉链节点
+    list_node_t inode_node; // inode 页链表节点
+    list_node_t lru_node;   // 最近使用链表节点
+    lock_t lock;            // 锁
+    bool vaild;             // 是否有效
+} page_t;
+
+// 获取 inode 文件第 index 页，没有缓存就从磁盘读取
+page_t* pcache_get(struct inode_t* inode, idx_t index);
+
+// 释放页的引用
+void pcache_put(page_t* page);
+
+// 从页的 start 处拷贝 len 个字节到 buf
+void pcache_read(page_t* page, char* buf, u32 start, u32 len);
+
+// 将 buf 的 len 个字节拷贝到页的 start 处，还没有写入磁盘
+void pcache_write(page_t* page, char* buf, u32 start, u32 len);
+
+// 将页中 [start, end) 的内容写入磁盘，文件块不存在就创建
+void pcache_flush(page_t* page, u32 start, u32 end);
+
+// 释放 inode 所有的缓存页，已经映射的进程仍然持有各自的引用
+// 文件的最后一个引用释放时如果还有缓存页，inode 留在未使用链表中，由淘汰最后一页时释放
+void pcache_free(struct inode_t* inode);
+
+// 物理内存不足时释放至多 count 个没有被引用和映射的页，返回释放的页数
+u32 pcache_shrink(u32 count);
+
+// 输出页缓存的统计信息
+void pcache_info();
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __ONIX_SLAB_HH__
+#define __ONIX_SLAB_HH__
+
+#include <onix/types.h>
+#include <ds/list.h>
+
+#define CACHE_NAME_LEN 16
+
+// 对象构造函数，只在 slab 创建时对每个对象调用一次
+typedef void (*cache_ctor_t)(void* object);
+
+// 对象缓存，管理同一种大小的内核对象
+typedef struct kmem_cache_t
+{
+    char name[CACHE_NAME_LEN];  // 缓存名称
+    u32 object_size;            // 对象大小
+    u32 size;                   // 每个对象实际占用的大小
+    u32 offset;                 // 空闲链表指针在对象中的偏移
+    u32 total;                  // 每个 slab 中对象的数量
+    cache_ctor_t ctor;          // 对象构造函数
+    list_t partial;             // 部分使用的 slab 链表
+    list_t full;                // 全部使用的 slab 链表
+    list_t empty;               // 全部空闲的 slab 链表
+    u32 empty_count;            // 空闲 slab 数量
+    u32 slab_count;             // slab 数量
+    u32 active;                 // 正在使用的对象数量
+    u32 allocs;                 // 累计分配次数
+    u32 frees;                  // 累计释放次数
+    list_node_t node;           // 缓存链表节点
+} kmem_cache_t;
+
+// 一个对象缓存的统计信息，通过 slab_stat 获得
+typedef struct slab_stat_t
+{
+    char name[CACHE_NAME_LEN];  // 缓存名称
+    u32 object_size;            // 对象大小
+    u32 slabs;                  // slab 数量
+    u32 active;                 // 正在使用的对象数量
+    u32 allocs;                 // 累计分配次数
+    u32 frees;                  // 累计释放次数
+} slab_stat_t;
+
+// 创建对象缓存，ctor 可以为空
+kmem_cache_t* kmem_cache_create(char* name, u32 size, cache_ctor_t ctor);
+
+// 销毁对象缓存，所有对象必须已经释放
+void kmem_cache_destroy(kmem_cache_t* cache);
+
+// 从缓存中分配一个对象
+void* kmem_cache_alloc(kmem_cache_t* cache);
+
+// 将对象释放回缓存
+void kmem_cache_free(kmem_cache_t* cache, void* object);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef __ONIX_SWAP_HH__
+#define __ONIX_SWAP_HH__
+
+#include <onix/types.h>
+
+// 交换分区的分区类型，与 Linux swap 相同
+#define SWAP_PART_SYSTEM 0x82
+
+// 是否找到了交换分区
+bool swap_enabled();
+
+// 空闲的交换槽数量，每个槽保存一页
+u32 swap_free_slots();
+
+// 分配一个交换槽，没有空闲的槽返回 0
+u32 swap_alloc();
+
+// 交换槽的引用 + 1，页表被复制时使用
+void swap_dup(u32 slot);
+
+// 释放交换槽的一个引用，引用为 0 时槽变为空闲
+void swap_free(u32 slot);
+
+// 交换锁，页表项换出与写入磁盘之间持有，换入的进程等待写入完成
+// 持有期间不能分配物理页，回收内存时同样需要这个锁
+void swap_lock();
+void swap_unlock();
+
+// 把物理页 paddr 的内容写入交换槽
+void swap_write(u32 slot, u32 paddr);
+
+// 从交换槽读取内容到物理页 paddr
+void swap_read(u32 slot, u32 paddr);
+
+// 输出交换分区的统计信息
+void swap_info();
+
+#endif
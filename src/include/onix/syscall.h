@@ -3,6 +3,9 @@
 
 #include <onix/types.h>
 #include <onix/stat.h>
+#include <onix/time.h>
+#include <onix/memory.h>
+#include <onix/slab.h>
 
 typedef enum syscall_t
 {
@@ -32,6 +35,7 @@ typedef enum syscall_t
     SYS_NR_DUP = 41,
     SYS_NR_PIPE = 42,
     SYS_NR_BRK = 45,
+    SYS_NR_IOCTL = 54,
     SYS_NR_UMASK = 60,
     SYS_NR_CHROOT = 61,
     SYS_NR_DUP2 = 63,
@@ -39,11 +43,19 @@ typedef enum syscall_t
     SYS_NR_READDIR = 89,
     SYS_NR_MMAP = 90,
     SYS_NR_MUNMAP = 91,
+    SYS_NR_MSYNC = 144,
     SYS_NR_YIELD = 158,
     SYS_NR_SLEEP = 162,
     SYS_NR_GETCWD = 183,
+    SYS_NR_VFORK = 190,
     SYS_NR_CLEAR = 200,
     SYS_NR_MKFS = 201,
+    SYS_NR_SPAWN = 202,
+    SYS_NR_CLOCK_STAT = 203,
+    SYS_NR_CLOCK_GETTIME = 204,
+    SYS_NR_NANOSLEEP = 205,
+    SYS_NR_MEMORY_STAT = 206,
+    SYS_NR_SLAB_STAT = 207,
 } syscall_t;
 
 enum mmap_type_t
@@ -56,11 +68,32 @@ enum mmap_type_t
     MAP_SHARED = 1,
     MAP_PRIVATE = 2,
     MAP_FIXED = 0x10,
+
+    MS_ASYNC = 1,
+    MS_INVALIDATE = 2,
+    MS_SYNC = 4,
+};
+
+// spawn 子进程开始执行之前，对文件描述符的操作
+enum spawn_action_type_t
+{
+    SPAWN_END = 0,      // 操作列表结束
+    SPAWN_DUP2 = 1,     // 把 fd 复制到 newfd
+    SPAWN_CLOSE = 2,    // 关闭 fd
 };
 
+typedef struct spawn_action_t
+{
+    int type;
+    fd_t fd;
+    fd_t newfd;
+} spawn_action_t;
+
 u32 test();
 
 pid_t fork();
+pid_t vfork();
+pid_t spawn(char* filename, char* argv[], char* envp[], spawn_action_t* actions);
 void exit(int status);
 
 pid_t waitpid(pid_t pid, int32* status);
@@ -68,18 +101,26 @@ pid_t waitpid(pid_t pid, int32* status);
 void yield();
 
 void sleep(u32 ms);
+int nanosleep(const timespec* req, timespec* rem);
 
 int32 brk(void* addr);
 void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset);
 int munmap(void* addr, size_t length);
+int msync(void* addr, size_t length, int flags);
 
 int32 write(fd_t fd, char* buf, u32 len);
 int32 read(fd_t fd, char* buf, u32 len);
+int ioctl(fd_t fd, int cmd, void* args);
 
 pid_t getpid();
 pid_t getppid();
 
 time_t time();
+int clock_stat(clock_stat_t* stat);
+int clock_gettime(int clockid, timespec* tp);
+
+int memory_stat(memory_stat_t* stat);
+int slab_stat(slab_stat_t* stats, int count);
 
 mode_t umask(mode_t mask);
 
@@ -5,6 +5,8 @@
 #include <ds/bitmap.h>
 #include <ds/list.h>
 #include <onix/fs.h>
+#include <onix/syscall.h>
+#include <onix/memory.h>
 
 #define KERNEL_USER 0
 #define NORMAL_USER 1000
@@ -52,6 +54,11 @@ typedef struct task_t
     struct inode_t* iexec;              // 程序文件 inode
     u16 umask;                          // 进程用户权限
     struct file_t* files[TASK_FILE_NR]; // 进程文件表
+    bool vfork;                         // vfork 的子进程，借用父进程的地址空间
+    list_t regions;                     // 文件映射区域链表，按开始地址排序
+    struct task_t* hash_next;           // pid 散列表中同一个桶的下一个任务
+    list_t children;                    // 子进程链表
+    list_node_t sibling;                // 父进程子进程链表中的节点
     u32 magic;                          // 内核魔数，校验溢出
 } task_t;
 
@@ -98,16 +105,25 @@ typedef struct intr_frame_t
 void task_yield();
 void task_exit(int status);
 pid_t task_fork();
+pid_t task_vfork();
+int task_vfork_exec(task_t* task);
+pid_t task_spawn(char* name, target_t entry, void* arg, spawn_action_t* actions);
 pid_t task_waitpid(pid_t pid, int32* status);
 
 task_t* running_task();
 void schedule();
 
+// 找到 pid 不小于 pid 的第一个任务，没有返回 NULL，用于遍历所有任务
+task_t* task_next(pid_t pid);
+
+// 除了正在运行的任务，没有其他就绪的任务
+bool task_ready_empty();
+
 void task_block(task_t* task, list_t* blist, task_state_t state);
 void task_unblock(task_t* task);
 
 void task_sleep(u32 ms);
-void task_wakeup();
+int task_nanosleep(const timespec* req, timespec* rem);
 
 fd_t task_get_fd(task_t* task);
 void task_put_fd(task_t* task, fd_t fd);
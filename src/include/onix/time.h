@@ -16,6 +16,28 @@ typedef struct tm
     int tm_isdst; // 夏令时标志
 } tm;
 
+#define NSEC_PER_SEC 1000000000
+#define NSEC_PER_MSEC 1000000
+
+// clock_gettime 的时钟
+#define CLOCK_REALTIME 0  // 从 1970-01-01 开始的时间
+#define CLOCK_MONOTONIC 1 // 启动以来的时间，不会回退
+
+typedef struct timespec
+{
+    time_t tv_sec;  // 秒数
+    u32 tv_nsec;    // 纳秒数 [0，999999999]
+} timespec;
+
+// 时钟中断的统计，通过 clock_stat 获得
+typedef struct clock_stat_t
+{
+    u32 hz;         // 每秒的时间片数量
+    u32 jiffies;    // 启动以来的时间片
+    u32 irqs;       // 时钟中断次数
+    u32 skipped;    // 跳过中断的时间片数量
+} clock_stat_t;
+
 void time_read_bcd(tm *time);
 void time_read(tm *time);
 time_t mktime(tm *time);
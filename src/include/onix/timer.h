@@ -0,0 +1,55 @@
+#ifndef __ONIX_TIMER_HH__
+#define __ONIX_TIMER_HH__
+
+#include <onix/types.h>
+#include <ds/list.h>
+
+struct timer_t;
+typedef void (*timer_handler_t)(struct timer_t* timer);
+
+// 内核定时器，到期时在时钟中断中调用处理函数，处理函数不能阻塞
+typedef struct timer_t
+{
+    list_node_t node;           // 时间轮槽中的链表节点，没有加入时为空
+    u32 expires;                // 到期的全局时间片
+    timer_handler_t handler;    // 处理函数
+    void* arg;                  // 处理函数的参数
+} timer_t;
+
+// 初始化定时器，之后才能加入时间轮
+void timer_setup(timer_t* timer, timer_handler_t handler, void* arg);
+
+// 定时器在全局时间片 expires 到期，定时器不能已经加入
+void timer_add(timer_t* timer, u32 expires);
+
+// 取消定时器，定时器还没有到期返回 true
+bool timer_del(timer_t* timer);
+
+// 修改到期时间，定时器已经到期或者被取消了就重新加入
+void timer_mod(timer_t* timer, u32 expires);
+
+// 定时器已经加入，还没有到期
+bool timer_pending(timer_t* timer);
+
+struct hrtimer_t;
+typedef void (*hrtimer_handler_t)(struct hrtimer_t* timer);
+
+// 高精度定时器，按单调时间的纳秒到期，时钟在最早的定时器到期时中断
+// 定时器按到期时间排成链表，加入是 O(n) 的，只用于不到一两个时间片的精确等待
+typedef struct hrtimer_t
+{
+    list_node_t node;           // 定时器链表的节点，没有加入时为空
+    u64 expires;                // 到期的单调时间，纳秒
+    hrtimer_handler_t handler;  // 处理函数
+    void* arg;                  // 处理函数的参数
+} hrtimer_t;
+
+void hrtimer_setup(hrtimer_t* timer, hrtimer_handler_t handler, void* arg);
+
+// 定时器在单调时间 expires 纳秒时到期，定时器不能已经加入
+void hrtimer_add(hrtimer_t* timer, u64 expires);
+
+// 取消定时器，定时器还没有到期返回 true
+bool hrtimer_del(hrtimer_t* timer);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __ONIX_ZRAM_HH__
+#define __ONIX_ZRAM_HH__
+
+#include <onix/types.h>
+
+// 压缩内存盘的统计信息，通过 DEV_CMD_ZRAM_STAT 获得
+typedef struct zram_stat_t
+{
+    u32 blocks;         // 磁盘的块数量
+    u32 same_blocks;    // 同值块数量，只保存这个值
+    u32 huge_blocks;    // 压缩不了的块数量，原样保存
+    u32 orig_size;      // 压缩保存的块的原始大小
+    u32 compr_size;     // 压缩之后的大小
+    u32 pages;          // 保存压缩数据使用的物理页数
+    u32 mem_limit;      // 保存压缩数据最多使用的物理页数
+    u32 failed_writes;  // 超过内存限制而失败的写次数
+    u32 read_bytes;     // 读的字节数
+    u32 write_bytes;    // 写的字节数
+    u64 read_cycles;    // 解压花费的时钟周期
+    u64 write_cycles;   // 压缩花费的时钟周期
+} zram_stat_t;
+
+#endif
@@ -3,8 +3,8 @@
 
 #include <onix/types.h>
 
-#define MAX(a, b) (a < b ? b : a)
-#define MIN(a, b) (a < b ? a : b)
+#define MAX(a, b) ((a) < (b) ? (b) : (a))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 void delay(u32 count);
 void hang();
@@ -14,6 +14,22 @@ u8 bin_to_bcd(u8 value);
 
 u32 div_round_up(u32 num, u32 size);
 
+// u64 除以 u32，返回商，余数放入 remainder（可以为空）
+u64 div_u64(u64 dividend, u32 divisor, u32* remainder);
+
 int atoi(const char* str);
 
+// rand 返回的最大值
+#define RAND_MAX 0x7fff
+
+// 线性同余的伪随机数，返回 [0, RAND_MAX]，相同的种子得到相同的序列
+int rand();
+void srand(u32 seed);
+
+// 堆内存分配
+void* malloc(size_t size);
+void free(void* ptr);
+void* calloc(size_t count, size_t size);
+void* realloc(void* ptr, size_t size);
+
 #endif
\ No newline at end of file
@@ -3,11 +3,25 @@
 #include <string.h>
 #include <stdlib.h>
 #include <onix/assert.h>
+#include <onix/debug.h>
+#include <onix/io.h>
 #include <onix/onix.h>
 
-extern u32 free_pages;
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+#define IDX(addr) ((u32)addr >> 12) // 获取 addr 的页索引
+
+// 每种描述符最多缓存的空闲 arena 数量，避免反复申请释放页面
+#define ARENA_EMPTY_MAX 2
+
 static arena_descriptor_t descriptors[DESC_COUNT];
 
+// 大小到描述符的查找表，以 16 字节为单位
+static u8 size_class[(ARENA_MAX_BLOCK >> 4) + 1];
+
+// 每个内核页所属的 arena，多页的 arena 中块不一定和 arena 在同一页
+static arena_t** arena_page;
+
 // 初始化 arent
 void arena_init()
 {
@@ -17,32 +31,84 @@ void arena_init()
         arena_descriptor_t* desc = descriptors + i;
         desc->block_size = block_size;
 
-        // 每页开始，保存一个 arena_t 结构体描述
-        desc->total_block = (PAGE_SIZE - sizeof(arena_t)) / block_size;
-        list_init(&(desc->free_list));
+        // 小块一页就够了，2K 与 4K 的块用多页，减少浪费
+        desc->pages = block_size <= 1024 ? 1 : block_size * 8 / PAGE_SIZE;
 
-        // 16、32、64... 1024 字节
+        // 每个 arena 开始，保存一个 arena_t 结构体描述
+        desc->total_block = (desc->pages * PAGE_SIZE - sizeof(arena_t)) / block_size;
+        desc->empty_count = 0;
+        list_init(&(desc->arena_list));
+
+        // 16、32、64... 4096 字节
         block_size <<= 1;
     }
+
+    // 每个 16 字节的大小对应的最小描述符
+    u32 idx = 0;
+    for (size_t i = 0; i <= (ARENA_MAX_BLOCK >> 4); ++i)
+    {
+        while (descriptors[idx].block_size < (i << 4))
+            idx++;
+        size_class[i] = idx;
+    }
+
+    u32 pages = IDX(KERNEL_MEMORY_SIZE) - IDX(MEMORY_BASE);
+    u32 count = div_round_up(pages * sizeof(arena_t*), PAGE_SIZE);
+    arena_page = (arena_t**)alloc_kpage(count);
+    memset(arena_page, 0, count * PAGE_SIZE);
+}
+
+// 设置 arena 所有页面的归属
+static void set_arena_page(arena_t* arena, u32 count, arena_t* value)
+{
+    u32 idx = IDX(arena) - IDX(MEMORY_BASE);
+    for (size_t i = 0; i < count; ++i)
+        arena_page[idx + i] = value;
+}
+
+// 通过某个内存对应的 arena 结构体指针
+static arena_t* get_block_arena(void* block)
+{
+    arena_t* arena = arena_page[IDX(block) - IDX(MEMORY_BASE)];
+    assert(arena);
+    return arena;
 }
 
-// 获得 arena 第 idx 块内存指针
-static void* get_arena_block(arena_t* arena, u32 idx)
+// 创建一个新的 arena，所有块串成空闲链表
+static arena_t* arena_create(arena_descriptor_t* desc)
 {
-    assert(arena->desc->total_block > idx);
+    arena_t* arena = (arena_t*)alloc_kpage(desc->pages);
 
-    // 内存开始是 arena 结构体，跳过
-    void *addr = (void*)(arena + 1);
+    arena->desc = desc;
+    // 没有超出范围，如果超过就把一整页作空间，而不需要空闲链表链接
+    arena->large = false;
+    // 初始空闲数量为总数
+    arena->count = desc->total_block;
+    arena->magic = ONIX_MAGIC;
+    arena->free = NULL;
 
-    // 偏移量 = 下标 * 每块的大小
-    u32 gap = idx * (arena->desc->block_size);
-    return (void*)((u32)addr + gap); 
+    // 倒序链接，分配的顺序是地址从低到高
+    u32 start = (u32)(arena + 1);
+    for (int i = desc->total_block - 1; i >= 0; --i)
+    {
+        block_t* block = (block_t*)(start + i * desc->block_size);
+        block->next = arena->free;
+        arena->free = block;
+    }
+
+    set_arena_page(arena, desc->pages, arena);
+    return arena;
 }
 
-// 通过某个内存对应的 arena 结构体指针
-static arena_t* get_block_arena(block_t* block)
+// 释放 arena 占用的页
+static void arena_destroy(arena_t* arena)
 {
-    return (arena_t*)((u32)block & 0xfffff000);
+    arena_descriptor_t* desc = arena->desc;
+    assert(arena->count == desc->total_block);
+
+    set_arena_page(arena, desc->pages, NULL);
+    arena->magic = 0;
+    free_kpage((u32)arena, desc->pages);
 }
 
 void* kmalloc(size_t size)
@@ -50,18 +116,16 @@ void* kmalloc(size_t size)
     arena_descriptor_t* desc = NULL;
     arena_t* arena = NULL;
     block_t* block;
-    char* addr;
 
-    // 申请内存超过最大的块 1024，用整夜来装，不用链表
-    if (size > 1024)
+    // 申请内存超过最大的块，用整页来装，不用链表
+    if (size > ARENA_MAX_BLOCK)
     {
         // 一页开始的是 arena_t
         u32 asize = size + sizeof(arena_t);
         // 计算需要的页面数量
         u32 count = div_round_up(asize, PAGE_SIZE);
 
-        arena = (arena_t*)alloc_kpage(count);
-        memset(arena, 0, count * PAGE_SIZE);
+        arena = (arena_t*)alloc_kpage_zero(count);
 
         arena->large = true;
         arena->count = count;
@@ -69,53 +133,41 @@ void* kmalloc(size_t size)
         arena->desc = NULL;
         arena->magic = ONIX_MAGIC;
 
+        // 返回的地址与 arena 在同一页
+        set_arena_page(arena, 1, arena);
+
         // 跳过 arena 结构体地址
         return (void*)(arena + 1);
     }
 
-    // 申请的大小可以在 7 个描述符找到
-    for (size_t i = 0; i < DESC_COUNT; ++i)
-    {
-        desc = descriptors + i;
-        // 找到块大小满足申请空间的最小描述符
-        if (desc->block_size >= size)
-            break;
-    }
+    // 查表得到块大小满足申请空间的最小描述符
+    desc = descriptors + size_class[(size + 15) >> 4];
+    assert(desc->block_size >= size);
 
-    assert(desc != NULL);
-
-    // 这种内存还没申请过，构建链表
-    if (list_empty(&(desc->free_list)))
+    // 没有空闲块了，新建一个 arena
+    if (list_empty(&(desc->arena_list)))
     {
-        arena = (arena_t*)alloc_kpage(1);
-        memset(arena, 0, PAGE_SIZE);
-
-        arena->desc = desc;
-        // 没有超出范围，如果超过就把一整页作空间，而不需要空闲链表链接
-        arena->large = false;
-        // 初始空闲数量为总数
-        arena->count = desc->total_block;
-        arena->magic = ONIX_MAGIC;
-
-        // 链接所有的空页，此时全空页，依次链接起来
-        for (size_t i = 0; i < desc->total_block; ++i)
-        {
-            block = get_arena_block(arena, i);
-            assert(!list_search(&(arena->desc->free_list), block));
-            list_push(&(arena->desc->free_list), block);
-            assert(list_search(&(arena->desc->free_list), block));
-        }
+        arena = arena_create(desc);
+        list_insert_after(&(desc->arena_list.head), &(arena->node));
+        desc->empty_count++;
     }
 
-    // 弹出闲链表的第一项
-    block = list_pop(&(desc->free_list));
-
-    // 找到块对应的 arena
-    arena = get_block_arena(block);
+    arena = element_entry(arena_t, node, desc->arena_list.head.next);
     assert(arena->magic == ONIX_MAGIC && !arena->large);
 
-    // 更新 arena
+    // 原来是空闲的 arena
+    if (arena->count == desc->total_block)
+        desc->empty_count--;
+
+    // 弹出空闲链表的第一项
+    block = arena->free;
+    arena->free = block->next;
     arena->count--;
+
+    // 用完了，移出描述符链表
+    if (!arena->count)
+        list_remove(&(arena->node));
+
     return block;
 }
 
@@ -129,29 +181,114 @@ void kfree(void* ptr)
     assert(arena->large == 1 || arena->large == 0);
     assert(arena->magic == ONIX_MAGIC);
 
-    // 如果大小超过 1024，没有链表的情况
+    // 如果大小超过最大的块，没有链表的情况
     if (arena->large == true)
     {
+        set_arena_page(arena, 1, NULL);
         free_kpage((u32)arena, arena->count);
         return;
     }
 
-    // 插入空闲链表头部，会导致链表的顺序不是地址高低的顺序
-    list_push(&(arena->desc->free_list), block);
+    arena_descriptor_t* desc = arena->desc;
+
+    // 原来是满的，重新放入描述符链表
+    if (!arena->count)
+        list_insert_after(&(desc->arena_list.head), &(arena->node));
+
+    // 插入 arena 的空闲链表头部
+    block->next = arena->free;
+    arena->free = block;
     arena->count++;
 
-    // 满了，所有块都是空闲，
-    if (arena->count == arena->desc->total_block)
+    if (arena->count != desc->total_block)
+        return;
+
+    // 所有块都是空闲，缓存的空闲 arena 太多就释放
+    if (desc->empty_count < ARENA_EMPTY_MAX)
+    {
+        desc->empty_count++;
+        return;
+    }
+
+    list_remove(&(arena->node));
+    arena_destroy(arena);
+}
+
+// 调整 ptr 的大小，内容保留
+void* krealloc(void* ptr, size_t size)
+{
+    if (!ptr)
+        return kmalloc(size);
+
+    if (!size)
+    {
+        kfree(ptr);
+        return NULL;
+    }
+
+    // 原来块的容量
+    arena_t* arena = get_block_arena(ptr);
+    assert(arena->magic == ONIX_MAGIC);
+
+    u32 capacity;
+    if (arena->large)
+        capacity = arena->count * PAGE_SIZE - sizeof(arena_t);
+    else
+        capacity = arena->desc->block_size;
+
+    // 放得下就不用动
+    if (size <= capacity)
+        return ptr;
+
+    void* addr = kmalloc(size);
+    memcpy(addr, ptr, capacity);
+    kfree(ptr);
+    return addr;
+}
+
+#define BENCH_SLOTS 256
+#define BENCH_OPS 100000
+
+extern u64 clock_monotonic();
+
+// 混合大小的分配与释放压力测试，需要在 clock_init 之后，用 TSC 计时
+void arena_bench()
+{
+    void** slots = (void**)kmalloc(BENCH_SLOTS * sizeof(void*));
+    memset(slots, 0, BENCH_SLOTS * sizeof(void*));
+
+    srand(1);
+    u64 start_ns = clock_monotonic();
+    u64 start = rdtsc();
+
+    for (size_t i = 0; i < BENCH_OPS; ++i)
     {
-        // 把链表打散，其实可以不用
-        for (size_t i = 0; i < arena->desc->total_block; ++i)
+        u32 slot = rand() % BENCH_SLOTS;
+
+        if (slots[slot])
         {
-            block = get_arena_block(arena, i);
-            assert(list_search(&(arena->desc->free_list), block));
-            list_remove(block);
-            assert(!list_search(&(arena->desc->free_list), block));
+            kfree(slots[slot]);
+            slots[slot] = NULL;
+            continue;
         }
-        free_kpage((u32)arena, 1);
+
+        // 大部分是小对象，少量大块
+        u32 size = rand() & 0xff;
+        if ((rand() & 0xf) == 0)
+            size = rand() & 0x1fff;
+        slots[slot] = kmalloc(size + 1);
+    }
+
+    u64 cycles = rdtsc() - start;
+    u64 ns = clock_monotonic() - start_ns;
+
+    for (size_t i = 0; i < BENCH_SLOTS; ++i)
+    {
+        if (slots[i])
+            kfree(slots[i]);
     }
-}   
+    kfree(slots);
 
+    LOGK("arena bench %d ops %d cycles/op %d ns/op\n", BENCH_OPS,
+         (u32)div_u64(cycles, BENCH_OPS, NULL), (u32)div_u64(ns, BENCH_OPS, NULL));
+}
@@ -2,24 +2,44 @@
 #include <ds/list.h>
 #include <onix/task.h>
 #include <string.h>
+#include <stdlib.h>
 #include <onix/debug.h>
 #include <onix/memory.h>
 #include <onix/device.h>
 #include <onix/assert.h>
+#include <onix/slab.h>
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
 // 哈希数量，应该是一个素数
 #define HASH_COUNT 31
 
-static buffer_t* buffer_start = (buffer_t*)KERNEL_BUFFER_MEM;
-static u32 buffer_count = 0;
+// 一页内存划分的缓冲块数量
+#define PAGE_BUFFERS (PAGE_SIZE / BLOCK_SIZE)
 
-// 记录当前 buffer_t 结构体的位置
-static buffer_t* buffer_ptr = (buffer_t*)KERNEL_BUFFER_MEM;
+// 高速缓冲最多使用物理内存的 1 / BUFFER_MEMORY_RATIO
+#define BUFFER_MEMORY_RATIO 8
 
-// 记录当前数据缓冲区位置
-static void* buffer_data = (void*)(KERNEL_BUFFER_MEM + KERNEL_BUFFER_SIZE - BLOCK_SIZE);
+// 高速缓冲的数据在内核的 16M 中，最多使用一半
+#define BUFFER_PAGES_MAX (KERNEL_MEMORY_SIZE / PAGE_SIZE / 2)
+
+// 内核空闲页少于这个数量时，高速缓冲不再增长
+#define BUFFER_RESERVE_PAGES 256
+
+// 同一页内存中的缓冲块，一起分配，一起释放
+typedef struct buffer_page_t
+{
+    buffer_t buffers[PAGE_BUFFERS]; // 缓冲块
+    list_node_t node;               // 缓冲页链表节点
+} buffer_page_t;
+
+// buffer_page_t 结构体从缓存中分配
+static kmem_cache_t* buffer_cache;
+
+// 所有的缓冲页
+static list_t page_list;
+static u32 buffer_pages = 0;        // 缓冲页数量
+static u32 buffer_pages_limit = 0;  // 缓冲页数量上限，由物理内存大小决定
 
 // 缓冲链表，被释放的块
 static list_t free_list;
@@ -58,7 +78,7 @@ static buffer_t* get_from_hash_table(dev_t dev, idx_t block)
         return NULL;
 
     // bf 存在缓冲列表，移除
-    if (list_search(&free_list, &(bf->rnode)))
+    if (bf->rnode.next)
         list_remove(&(bf->rnode));
 
     return bf;
@@ -69,41 +89,88 @@ static void hash_locate(buffer_t* bf)
 {
     u32 idx = hash(bf->dev, bf->block);
     list_t* list = hash_table + idx;
-    assert(!list_search(list, &(bf->hnode)));
-    list_push(list, &(bf->hnode));
+    assert(!bf->hnode.next);
+    list_insert_after(&(list->head), &(bf->hnode));
 }
 
 // 将 bf 从哈希表移除
 static void hash_remove(buffer_t* bf)
 {
-    u32 idx = hash(bf->dev, bf->block);
-    list_t* list = hash_table + idx;
-    assert(list_search(list, &(bf->hnode)));
+    assert(bf->hnode.next);
     list_remove(&(bf->hnode));
 }
 
-// 在内存中初始化一个 buffer 
-static buffer_t* get_new_buffer()
+// 高速缓冲增长一页，新的缓冲块放到空闲链表的末尾，最先被使用
+static bool buffer_grow()
 {
-    buffer_t* bf = NULL;    
-    // 判断内存是否足够
-    if ((u32)buffer_ptr + sizeof(buffer_t) < (u32)buffer_data)
+    if (buffer_pages >= buffer_pages_limit)
+        return false;
+    if (kernel_free_page_count() < BUFFER_RESERVE_PAGES)
+        return false;
+
+    buffer_page_t* page = kmem_cache_alloc(buffer_cache);
+    char* data = (char*)alloc_kpage(1);
+    memset(page, 0, sizeof(buffer_page_t));
+
+    for (size_t i = 0; i < PAGE_BUFFERS; i++)
     {
-        bf = buffer_ptr;
-        bf->data = buffer_data;
+        buffer_t* bf = page->buffers + i;
+        bf->data = data + i * BLOCK_SIZE;
         bf->dev = EOF;
-        bf->block = 0;
-        bf->count = 0;
-        bf->dirty = false;
-        bf->vaild = false;
         lock_init(&(bf->lock));
-        buffer_count++;
-        buffer_ptr++;
-        buffer_data -= BLOCK_SIZE;
-        LOGK("buffer count %d\n", buffer_count);
+        list_insert_before(&(free_list.tail), &(bf->rnode));
     }
 
-    return bf;
+    list_insert_after(&(page_list.head), &(page->node));
+    buffer_pages++;
+    LOGK("buffer pages %d\n", buffer_pages);
+    return true;
+}
+
+// 缓冲页中的缓冲块都没有被引用，可以释放
+static bool buffer_page_idle(buffer_page_t* page)
+{
+    for (size_t i = 0; i < PAGE_BUFFERS; i++)
+    {
+        buffer_t* bf = page->buffers + i;
+        if (bf->count || !bf->rnode.next)
+            return false;
+    }
+    return true;
+}
+
+// 内核内存不足时，释放至多 count 个空闲的缓冲页，返回释放的页数
+u32 buffer_shrink(u32 count)
+{
+    u32 freed = 0;
+    list_node_t* node = page_list.tail.prve;
+    while (freed < count && node != &(page_list.head))
+    {
+        buffer_page_t* page = element_entry(buffer_page_t, node, node);
+        node = node->prve;
+
+        if (!buffer_page_idle(page))
+            continue;
+
+        // 缓冲都是写穿的，空闲的缓冲不会是脏的
+        for (size_t i = 0; i < PAGE_BUFFERS; i++)
+        {
+            buffer_t* bf = page->buffers + i;
+            assert(!bf->dirty);
+            if (bf->hnode.next)
+                hash_remove(bf);
+            list_remove(&(bf->rnode));
+        }
+
+        list_remove(&(page->node));
+        free_kpage((u32)page->buffers[0].data, 1);
+        kmem_cache_free(buffer_cache, page);
+        buffer_pages--;
+        freed++;
+    }
+
+    LOGK("buffer shrink %d pages, %d left\n", freed, buffer_pages);
+    return freed;
 }
 
 // 获得空闲的 buffer
@@ -112,17 +179,18 @@ static buffer_t* get_free_buffer()
     buffer_t* bf = NULL;
     while (true)
     {
-        // 如果内存足够，直接获得缓冲
-        bf = get_new_buffer();
-        if (bf)
-            return bf;
-        
-        // 否则，从空闲列表获得
+        // 没有空闲块，或者只能淘汰缓存的数据时，内存足够的话先增长
+        buffer_t* last = list_empty(&free_list) ? NULL :
+                         element_entry(buffer_t, rnode, free_list.tail.prve);
+        if (!last || last->hnode.next)
+            buffer_grow();
+
+        // 从空闲列表获得最远没有被访问的块，新增长的块在末尾
         if (!list_empty(&(free_list)))
         {
-            // 取最远没有被访问的块
             bf = element_entry(buffer_t, rnode, list_popback(&free_list));
-            hash_remove(bf);
+            if (bf->hnode.next)
+                hash_remove(bf);
             bf->vaild = false;
             return bf;
         }
@@ -187,7 +255,9 @@ void bwrite(buffer_t* bf)
     assert(bf);
     if (!bf->dirty)
         return;
-    device_request(bf->dev, bf->data, BLOCK_SECS, bf->block * BLOCK_SECS, 0, REQ_WRITE);
+    // 写入失败时保留脏标记，以后再写
+    if (device_request(bf->dev, bf->data, BLOCK_SECS, bf->block * BLOCK_SECS, 0, REQ_WRITE) < 0)
+        return;
     bf->dirty = false;
     bf->vaild = true;
 }
@@ -207,7 +277,7 @@ void brelse(buffer_t* bf)
 
     assert(!bf->rnode.next);
     assert(!bf->rnode.prve);
-    list_push(&free_list, &bf->rnode);
+    list_insert_after(&(free_list.head), &(bf->rnode));
     if (!list_empty(&wait_list))
     {
         task_t *task = element_entry(task_t, node, list_popback(&wait_list));
@@ -219,6 +289,13 @@ void buffer_init()
 {
     LOGK("buffer_t size is %d\n", sizeof(buffer_t));
 
+    buffer_cache = kmem_cache_create("buffer", sizeof(buffer_page_t), NULL);
+    list_init(&page_list);
+
+    // 按物理内存的大小决定高速缓冲的上限，内存不足时再缩小
+    buffer_pages_limit = MIN(memory_total_pages() / BUFFER_MEMORY_RATIO, BUFFER_PAGES_MAX);
+    LOGK("buffer pages limit %d\n", buffer_pages_limit);
+
     // 初始化空闲链表
     list_init(&free_list);
     // 初始化等待进行链表
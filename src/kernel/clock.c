@@ -5,6 +5,10 @@
 #include <onix/task.h>
 #include <onix/printk.h>
 #include <onix/onix.h>
+#include <onix/time.h>
+#include <stdlib.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
 #define PIT_CHAN0_REG 0X40
 #define PIT_CHAN2_REG 0X42
@@ -15,6 +19,26 @@
 #define CLOCK_COUNTER (OSCILLATOR / HZ)
 #define JIFFY (1000 / HZ)
 
+// 跳过时钟中断时，一次最多经过的时间片
+// 计数器只有 16 位，还要留出读取计数器时已经过去的部分
+#define CLOCK_SKIP_MAX (60000 / CLOCK_COUNTER)
+
+// 单次计数最少的计数，太短的话设置完之前就已经数完了
+#define CLOCK_COUNT_MIN 20
+
+// 改回周期计数时，可以丢掉的不满一个时间片的计数，大约 50 微秒
+#define CLOCK_SLACK 60
+
+// 纳秒换算为计数器的计数：count = ns * PIT_MULT >> 32
+#define PIT_MULT ((u32)(((u64)OSCILLATOR << 32) / NSEC_PER_SEC))
+
+// 校准 TSC 时轮询计数器 0 经过的计数，大约 50 毫秒
+#define CALIBRATE_COUNTS (CLOCK_COUNTER * 5)
+
+// TSC 周期换算为纳秒：ns = cycles * tsc_mult >> TSC_SHIFT
+#define TSC_SHIFT 22
+#define TSC_FRAC_MASK ((1 << TSC_SHIFT) - 1)
+
 #define SPEAKER_REG 0x61
 #define BEEP_HZ 440
 #define BEEP_COUNTER (OSCILLATOR / BEEP_HZ)
@@ -25,6 +49,224 @@ u32 jiffy = JIFFY;
 
 u32 volatile beeping = 0;
 
+// 没有其他就绪的任务时，计数器 0 改为单次计数，直接在下一个定时器到期时中断
+// 有高精度定时器时，在它到期的时刻单次计数中断
+static bool clock_oneshot;      // 计数器 0 为单次计数
+static bool clock_skipping;     // 单次计数跨过了多个时间片
+static bool clock_handling;     // 正在处理时钟中断，处理完会重新设置计数器
+static u32 clock_period;        // 计数器上次读出的值，单次计数开始时为初值
+static u32 clock_pending;       // 还没有计入时间片的计数
+static clock_stat_t irq_stat;   // 时钟中断的统计
+
+// 单调时间由 TSC 得到，每次时钟中断更新一次基准，两次更新之间 TSC 的增量不会太大
+static u32 tsc_mult;            // 每个周期的纳秒数左移 TSC_SHIFT 位，为 0 时 TSC 不可用
+static u64 tsc_base;            // 上次更新时的 TSC
+static u64 mono_base;           // tsc_base 对应的单调时间，纳秒
+static u32 mono_frac;           // mono_base 不满 1 纳秒的部分，左移了 TSC_SHIFT 位
+
+// 读取计数器 0 当前的值
+static u32 pit_read()
+{
+    outb(PIT_CTRL_REG, 0b00000000);
+    u32 value = inb(PIT_CHAN0_REG);
+    value |= inb(PIT_CHAN0_REG) << 8;
+    return value;
+}
+
+// 计数器 0 从 count 开始单次计数，到 0 时中断，之后继续减并回绕
+static void pit_oneshot(u32 count)
+{
+    outb(PIT_CTRL_REG, 0b00110000);
+    outb(PIT_CHAN0_REG, count & 0xff);
+    outb(PIT_CHAN0_REG, (count >> 8) & 0xff);
+    clock_oneshot = true;
+    clock_period = count;
+}
+
+// 计数器 0 周期计数，每个时间片中断一次
+static void pit_periodic()
+{
+    outb(PIT_CTRL_REG, 0b00110100);
+    outb(PIT_CHAN0_REG, CLOCK_COUNTER & 0xff);
+    outb(PIT_CHAN0_REG, (CLOCK_COUNTER >> 8) & 0xff);
+    clock_oneshot = false;
+    clock_pending = 0;
+}
+
+// 计入单次计数上次读出之后经过的计数，计数器数到 0 之后继续减并回绕
+static void clock_fold()
+{
+    u32 value = pit_read();
+    clock_pending += (u16)(clock_period - value);
+    clock_period = value;
+}
+
+// 上次中断以来经过的时间片，不满一个时间片的计数留到下次
+static u32 clock_elapsed()
+{
+    if (!clock_oneshot)
+        return 1;
+
+    // 中断之后计数器回绕，差值包括中断处理之前多走的部分
+    clock_fold();
+    u32 ticks = clock_pending / CLOCK_COUNTER;
+    clock_pending %= CLOCK_COUNTER;
+    return ticks;
+}
+
+// TSC 从 tsc_base 到 tsc 经过的纳秒数，不满 1 纳秒的部分放入 frac
+static u64 tsc_delta_ns(u64 tsc, u32* frac)
+{
+    u64 delta = tsc - tsc_base;
+    u64 scaled = mono_frac;
+    u64 ns = 0;
+
+    // 32 位乘 32 位不会溢出，中断关闭太久时分段计算
+    while (delta >> 31)
+    {
+        scaled += (u64)0x80000000 * tsc_mult;
+        ns += scaled >> TSC_SHIFT;
+        scaled &= TSC_FRAC_MASK;
+        delta -= 0x80000000;
+    }
+    scaled += (u64)(u32)delta * tsc_mult;
+    *frac = scaled & TSC_FRAC_MASK;
+    return ns + (scaled >> TSC_SHIFT);
+}
+
+// 时钟中断中更新单调时间的基准
+static void clock_update()
+{
+    if (!tsc_mult)
+        return;
+
+    u64 tsc = rdtsc();
+    mono_base += tsc_delta_ns(tsc, &mono_frac);
+    tsc_base = tsc;
+}
+
+// 启动以来的单调时间，纳秒
+u64 clock_monotonic()
+{
+    bool intr = interrupt_disable();
+
+    u64 ns;
+    if (tsc_mult)
+    {
+        u32 frac;
+        ns = mono_base + tsc_delta_ns(rdtsc(), &frac);
+    }
+    else
+    {
+        // 没有可用的 TSC，只能精确到时间片
+        ns = (u64)jiffies * JIFFY * NSEC_PER_MSEC;
+    }
+
+    set_interrupt_state(intr);
+    return ns;
+}
+
+extern bool hrtimer_next(u64* expires);
+extern void hrtimer_wakeup(u64 now);
+
+// 从现在到最早的高精度定时器到期的计数，没有定时器或者不早于 max 时返回 max
+static u32 clock_hrtimer_counts(u32 max)
+{
+    u64 expires;
+    if (!hrtimer_next(&expires))
+        return max;
+
+    u64 now = clock_monotonic();
+    if (expires <= now)
+        return MIN(CLOCK_COUNT_MIN, max);
+
+    u64 delta = expires - now;
+    if (delta >> 32)
+        return max;
+
+    // 向上取整，不能在到期之前中断
+    u32 counts = (((u64)(u32)delta * PIT_MULT) >> 32) + 1;
+    if (counts < CLOCK_COUNT_MIN)
+        counts = CLOCK_COUNT_MIN;
+    return MIN(counts, max);
+}
+
+// 设置下一次中断在 ticks 个时间片之后，高精度定时器更早到期时在到期时中断
+static void clock_program(u32 ticks)
+{
+    // 周期计数时 clock_pending 为 0
+    u32 counts = ticks * CLOCK_COUNTER - clock_pending;
+    u32 hrcounts = clock_hrtimer_counts(counts);
+    if (hrcounts < counts)
+    {
+        clock_skipping = clock_pending + hrcounts > CLOCK_COUNTER;
+        pit_oneshot(hrcounts);
+        return;
+    }
+
+    clock_skipping = ticks > 1;
+    if (clock_skipping || clock_pending > CLOCK_SLACK)
+    {
+        // 不满一个时间片时先数到时间片的边界，之后再改回周期计数，时间片才不会漂移
+        pit_oneshot(counts);
+    }
+    else if (clock_oneshot)
+    {
+        pit_periodic();
+    }
+}
+
+// 跳过时钟中断期间 jiffies 落后于实际的时间，把已经经过的时间片计入 jiffies
+// 按 jiffies 计算到期时间之前调用，已经设置的中断时刻不变
+void clock_catchup()
+{
+    assert(!get_interrupt_state());
+    if (!clock_oneshot || clock_handling)
+        return;
+
+    clock_fold();
+    u32 ticks = clock_pending / CLOCK_COUNTER;
+    clock_pending %= CLOCK_COUNTER;
+    jiffies += ticks;
+    irq_stat.skipped += ticks;
+}
+
+// 跳过时钟中断期间有了新的就绪任务或定时器，改为在下一个时间片中断
+void clock_kick()
+{
+    assert(!get_interrupt_state());
+    if (!clock_skipping || clock_handling)
+        return;
+
+    clock_fold();
+    pit_oneshot(CLOCK_COUNTER - clock_pending % CLOCK_COUNTER);
+    clock_skipping = false;
+}
+
+// 加入了最早到期的高精度定时器，在下一次中断之前到期时提前中断
+void clock_hrtimer_kick()
+{
+    assert(!get_interrupt_state());
+
+    // 中断已经发生还没有处理时，处理中断时会重新设置计数器
+    if (clock_handling || interrupt_pending(IRQ_CLOCK))
+        return;
+
+    // 计数器的值就是到下一次中断剩余的计数
+    u32 value = pit_read();
+    u32 counts = clock_hrtimer_counts(value);
+    if (counts >= value)
+        return;
+
+    if (clock_oneshot)
+        clock_fold();
+    else
+        clock_pending = CLOCK_COUNTER - value;
+
+    clock_skipping = clock_pending % CLOCK_COUNTER + counts > CLOCK_COUNTER;
+    pit_oneshot(counts);
+}
+
 void start_beep()
 {
     if (!beeping)
@@ -41,40 +283,85 @@ void stop_beep()
     }
 }
 
-extern void task_wakeup();
+extern void timer_wakeup();
+extern u32 timer_next_ticks(u32 max);
 
 // 时钟中断处理函数
 void clock_handler(int vector)
 {
     assert(vector == 0x20);
     send_eoi(vector);
-    
+    clock_handling = true;
+
+    // 跳过时钟中断时，一次可能经过多个时间片，高精度定时器的中断可能不满一个时间片
+    u32 ticks = clock_elapsed();
+    jiffies += ticks;
+    irq_stat.irqs++;
+    if (ticks > 1)
+        irq_stat.skipped += ticks - 1;
+
+    clock_update();
+
     // 检测并停止蜂鸣器
     stop_beep();
-    // 唤醒睡眠结束的任务
-    task_wakeup();
 
-    jiffies++;
-    
+    // 处理到期的定时器，唤醒睡眠结束的任务
+    timer_wakeup();
+    hrtimer_wakeup(clock_monotonic());
+
     task_t* task = running_task();
     //printk("current task: 0x%p\n", task);
     
     assert(task->magic == ONIX_MAGIC);
 
     task->jiffies = jiffies;
-    task->ticks--;
-    if (!task->ticks)
-    {
+    bool expired = ticks && task->ticks <= ticks;
+    if (expired)
         task->ticks = task->priority;
+    else
+        task->ticks -= ticks;
+
+    // 没有其他就绪的任务时，当前任务会继续执行，直到下一个定时器到期都不需要中断
+    ticks = 1;
+    if (task_ready_empty() && !beeping)
+        ticks = timer_next_ticks(CLOCK_SKIP_MAX);
+    clock_program(ticks);
+    clock_handling = false;
+
+    if (expired)
         schedule();
-    }
+}
+
+// 获取时钟中断的统计
+int sys_clock_stat(clock_stat_t* stat)
+{
+    clock_catchup();
+    irq_stat.jiffies = jiffies;
+    irq_stat.hz = HZ;
+    *stat = irq_stat;
+    return 0;
 }
 
 extern u32 startup_time;
 
 u32 sys_time()
 {
-    return startup_time + (jiffies * JIFFY) / 1000;
+    return startup_time + (u32)div_u64(clock_monotonic(), NSEC_PER_SEC, NULL);
+}
+
+int sys_clock_gettime(int clockid, timespec* tp)
+{
+    if (clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC)
+        return EOF;
+
+    u32 nsec;
+    tp->tv_sec = (u32)div_u64(clock_monotonic(), NSEC_PER_SEC, &nsec);
+    tp->tv_nsec = nsec;
+
+    // 启动时从 CMOS 读出的时间，加上单调时间
+    if (clockid == CLOCK_REALTIME)
+        tp->tv_sec += startup_time;
+    return 0;
 }
 
 void pit_init()
@@ -90,9 +377,45 @@ void pit_init()
     outb(PIT_CHAN2_REG, (u8)(BEEP_COUNTER >> 8));
 }
 
+// 轮询周期计数的计数器 0，对比 TSC 的增量得到 TSC 的频率，这时中断是关闭的
+static void tsc_calibrate()
+{
+    assert(!get_interrupt_state());
+
+    // 从计数变化的时刻开始，计数器从 CLOCK_COUNTER 减到 1 之后重新装入
+    u32 last = pit_read();
+    u32 value;
+    while ((value = pit_read()) == last)
+        ;
+    u64 start = rdtsc();
+
+    u32 counts = 0;
+    last = value;
+    while (counts < CALIBRATE_COUNTS)
+    {
+        value = pit_read();
+        counts += value <= last ? last - value : last + CLOCK_COUNTER - value;
+        last = value;
+    }
+    u64 cycles = rdtsc() - start;
+
+    // 经过的纳秒数，TSC 太慢时乘数放不下，只能用时间片
+    u32 ns = (u32)div_u64((u64)counts * NSEC_PER_SEC, OSCILLATOR, NULL);
+    if (!cycles || (cycles >> 32) || (cycles << (32 - TSC_SHIFT)) <= ns)
+    {
+        LOGK("tsc unusable, monotonic clock falls back to jiffies\n");
+        return;
+    }
+
+    tsc_mult = (u32)div_u64((u64)ns << TSC_SHIFT, (u32)cycles, NULL);
+    tsc_base = rdtsc();
+    LOGK("tsc %u kHz, mult %u\n", (u32)div_u64(cycles * 1000000, ns, NULL), tsc_mult);
+}
+
 void clock_init()
 {
     pit_init();
+    tsc_calibrate();
     // 设置时钟中断函数
     set_interrupt_handler(IRQ_CLOCK, clock_handler);
     // 打开时钟中断
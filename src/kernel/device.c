@@ -3,7 +3,7 @@
 #include <onix/task.h>
 #include <onix/assert.h>
 #include <onix/debug.h>
-#include <onix/arena.h>
+#include <onix/slab.h>
 #include <ds/list.h>
 #include <onix/onix.h>
 
@@ -13,6 +13,9 @@
 
 static device_t devices[DEVICE_NR];
 
+// 块设备请求缓存
+static kmem_cache_t* request_cache;
+
 // 获取空设备
 static device_t* get_null_device()
 {
@@ -75,6 +78,10 @@ device_t* device_get(dev_t dev)
 // 控制设备
 int device_ioctl(dev_t dev, int cmd, void* args, int flags)
 {
+    // 设备号来自用户创建的设备文件，可能不存在
+    if (dev < 0 || dev >= DEVICE_NR || devices[dev].type == DEV_NULL)
+        return EOF;
+
     // 找到对应的设备，使用设备本身的函数指针
     device_t* device = device_get(dev);
     if (device->ioctl)
@@ -126,23 +133,22 @@ void device_init()
     }
 }
 
-// 执行块设备请求
-static void do_request(request_t *req)
+// 执行块设备请求，返回设备读写的结果
+static int do_request(request_t *req)
 {
     LOGK("dev %d do request idx %d\n", req->dev, req->idx);
 
     switch (req->type)
     {
     case REQ_READ:
-        device_read(req->dev, req->buf, req->count, req->idx, req->flags);
-        break;
+        return device_read(req->dev, req->buf, req->count, req->idx, req->flags);
     case REQ_WRITE:
-        device_write(req->dev, req->buf, req->count, req->idx, req->flags);
-        break;
+        return device_write(req->dev, req->buf, req->count, req->idx, req->flags);
     default:
         panic("req type %d unknown!!!");
         break;
     }
+    return EOF;
 }
 
 // 获得下一个请求
@@ -172,8 +178,8 @@ static request_t* request_next_req(device_t* device, request_t* req)
     return element_entry(request_t, node, next);
 }
 
-// 块设备请求
-void device_request(dev_t dev, void *buf, u8 count, idx_t idx, int flags, u32 type)
+// 块设备请求，设备读写失败时返回 EOF
+int device_request(dev_t dev, void *buf, u8 count, idx_t idx, int flags, u32 type)
 {
     device_t *device = device_get(dev);
     assert(device->type = DEV_BLOCK); // 是块设备
@@ -184,7 +190,7 @@ void device_request(dev_t dev, void *buf, u8 count, idx_t idx, int flags, u32 ty
         device = device_get(device->parent);
 
     // 创建一个请求结构体，赋上参数
-    request_t *req = kmalloc(sizeof(request_t));
+    request_t *req = kmem_cache_alloc(request_cache);
     req->dev = device->dev;
     req->buf = buf;
     req->count = count;
@@ -210,14 +216,14 @@ void device_request(dev_t dev, void *buf, u8 count, idx_t idx, int flags, u32 ty
     }
 
     // 阻塞解开或链表为空，可用处理这个请求
-    do_request(req);
+    int ret = do_request(req);
 
     // 获得下一关请求
     request_t* next_req = request_next_req(device, req);
 
     // 处理完，释放节点，释放内存空间
     list_remove(&req->node);
-    kfree(req);
+    kmem_cache_free(request_cache, req);
 
     // 如果此时链表还有请求，就唤醒最后一个——先来先服务策略
     if (next_req)
@@ -225,4 +231,19 @@ void device_request(dev_t dev, void *buf, u8 count, idx_t idx, int flags, u32 ty
         assert(next_req->task->magic == ONIX_MAGIC);
         task_unblock(next_req->task);
     }
+    return ret < 0 ? EOF : 0;
+}
+
+// 请求的链表节点在移出链表时会被清空，所以只需要构造一次
+static void request_ctor(void* object)
+{
+    request_t* req = (request_t*)object;
+    req->node.prve = NULL;
+    req->node.next = NULL;
+}
+
+// 块设备请求初始化，需要在 slab_init 之后
+void request_init()
+{
+    request_cache = kmem_cache_create("request", sizeof(request_t), request_ctor);
 }
\ No newline at end of file
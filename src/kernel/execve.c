@@ -6,6 +6,7 @@
 #include <onix/memory.h>
 #include <onix/syscall.h>
 #include <onix/task.h>
+#include <onix/arena.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -215,45 +216,26 @@ static bool elf_validate(Elf32_Ehdr *ehdr)
     return true;
 }
 
+// 记录可加载的段
 static void load_segment(inode_t* inode, Elf32_Phdr* phdr)
 {
     // 对齐到页
     assert(phdr->p_align == 0x1000);
     assert((phdr->p_vaddr & 0xfff) == 0);
 
+    // 文件中的偏移也要对齐到页，才能按页从文件读取
+    assert((phdr->p_offset & 0xfff) == 0);
+
     u32 vaddr = phdr->p_vaddr;
 
     // 需要的页面数量
     u32 count = div_round_up(MAX(phdr->p_memsz, phdr->p_filesz), PAGE_SIZE);
+    assert(vaddr >= USER_EXEC_ADDR && vaddr + count * PAGE_SIZE <= USER_MMAP_ADDR);
 
-    // 对每一页：计算起始内存位置，链接一个物理页
-    for (size_t i = 0; i < count; ++i)
-    {
-        u32 addr = vaddr + i * PAGE_SIZE;
-        assert(addr >= USER_EXEC_ADDR && addr < USER_MMAP_ADDR);
-        link_page(addr);
-    }
-
-    // 读取文件到内存中
-    inode_read(inode, (char*)vaddr, phdr->p_filesz, phdr->p_offset);
-
-    // 如果内存中需要的字节比文件保存的多，即 .bss 段，剩下的部分全部填充 0
-    if (phdr->p_filesz < phdr->p_memsz)
-        memset((char*)vaddr + phdr->p_filesz, 0, phdr->p_memsz - phdr->p_filesz);
-
-    // 如果段不可写，设置为只读（代码段）
-    if ((phdr->p_flags & PF_W) == 0)
-    {
-        // 对每个页面：取出页表项，设置不可写、只读
-        for (size_t i = 0; i < count; i++)
-        {
-            u32 addr = vaddr + i * PAGE_SIZE;
-            page_entry_t* entry = get_entry(addr, false);
-            entry->write = false;
-            entry->readonly = true;
-            flush_tlb(addr);
-        }
-    }
+    // 不立即读取文件，记录为文件映射区域，访问时缺页再读取
+    // 超过 p_filesz 的部分是 .bss 段，缺页时填充 0
+    u32 flags = (phdr->p_flags & PF_W) ? REGION_WRITE : 0;
+    region_add(vaddr, vaddr + count * PAGE_SIZE, inode, phdr->p_offset, vaddr + phdr->p_filesz, flags);
 
     // 更新进程结构体中的信息
     task_t* task = running_task();
@@ -273,38 +255,44 @@ static void load_segment(inode_t* inode, Elf32_Phdr* phdr)
 
 static u32 load_elf(inode_t* inode)
 {
-    // 给用户程序做物理页映射
-    link_page(USER_EXEC_ADDR);
+    // ELF 文件头与程序段头表读取到内核页中
+    char* buf = (char*)alloc_kpage(1);
+    u32 entry = EOF;
 
     int n = 0;
-    // 读取 ELF 文件头，读取到 USER_EXEC_ADDR 位置
-    n = inode_read(inode, (char*)USER_EXEC_ADDR, sizeof(Elf32_Ehdr), 0);
-    assert(n == sizeof(Elf32_Ehdr));
+    // 读取 ELF 文件头
+    n = inode_read(inode, buf, sizeof(Elf32_Ehdr), 0);
+    Elf32_Ehdr* ehdr = (Elf32_Ehdr*)buf;
 
     // 验证
-    Elf32_Ehdr* ehdr = (Elf32_Ehdr*)USER_EXEC_ADDR;
-    if (!elf_validate(ehdr))
-        return EOF;
+    if (n != sizeof(Elf32_Ehdr) || !elf_validate(ehdr))
+        goto rollback;
+
+    u32 size = ehdr->e_phnum * ehdr->e_phentsize;
+    if (sizeof(Elf32_Ehdr) + size > PAGE_SIZE)
+        goto rollback;
 
     // 读取程序段头表，读取到 ELF 文件头后
-    Elf32_Phdr* phdr = (Elf32_Phdr*)(USER_EXEC_ADDR + sizeof(Elf32_Ehdr));
-    n = inode_read(inode, (char*)phdr, ehdr->e_phnum * ehdr->e_phentsize, ehdr->e_phoff);
+    Elf32_Phdr* phdr = (Elf32_Phdr*)(buf + sizeof(Elf32_Ehdr));
+    n = inode_read(inode, (char*)phdr, size, ehdr->e_phoff);
+    if (n != size)
+        goto rollback;
 
-    // 根据程序段头表，读取段头
-    Elf32_Phdr* ptr = phdr;
+    // 根据程序段头表，记录可加载的段
     for (size_t i = 0; i < ehdr->e_phnum; ++i)
     {
         // 如果这个段可加载
-        if (ptr->p_type != PT_LOAD)
+        if (phdr[i].p_type != PT_LOAD)
             continue;
-        load_segment(inode, ptr);
-
-        // 遍历段头表的每一项
-        ptr++;
+        load_segment(inode, phdr + i);
     }
     
     // 返回程序的入口地址
-    return ehdr->e_entry;
+    entry = ehdr->e_entry;
+
+rollback:
+    free_kpage((u32)buf, 1);
+    return entry;
 }
 
 static int count_argv(char* argv[])
@@ -317,15 +305,32 @@ static int count_argv(char* argv[])
     return i;
 }
 
-static u32 copy_argv_envp(char* filename, char* argv[], char* envp[])
+// 参数与环境变量占用的内核页数
+#define ARGS_PAGES 4
+
+// 在内核页中构造好用户栈上的参数与环境变量，返回内核页地址，映像的长度写入 size
+// 映像在内核页的末尾，拷贝到用户栈顶即可，这样可以在切换地址空间之前读取用户的参数
+// 参数太多或者内核页不够时返回 0
+static u32 build_argv_envp(char* filename, char* argv[], char* envp[], u32* size)
 {
     // 计算参数数量
     int argc = count_argv(argv) + 1;
     int envc = count_argv(envp);
 
+    // 两个指针数组与 argc，加上所有的字符串，要放得下
+    u32 total = (argc + 1 + envc + 1) * 4 + 4 + strlen(filename) + 1;
+    for (int i = 0; i < argc - 1; i++)
+        total += strlen(argv[i]) + 1;
+    for (int i = 0; i < envc; i++)
+        total += strlen(envp[i]) + 1;
+    if (total >= ARGS_PAGES * PAGE_SIZE || (argc + 1 + envc + 1) * 4 > PAGE_SIZE)
+        return 0;
+
     // 分配内核内存，用于临时存储参数
-    u32 pages = alloc_kpage(4);
-    u32 pages_end = pages + 4 * PAGE_SIZE;
+    u32 pages = try_alloc_kpage(ARGS_PAGES);
+    if (!pages)
+        return 0;
+    u32 pages_end = pages + ARGS_PAGES * PAGE_SIZE;
 
     // 内核临时栈顶地址
     char* ktop = (char*)pages_end;
@@ -333,7 +338,12 @@ static u32 copy_argv_envp(char* filename, char* argv[], char* envp[])
     char* utop = (char*)USER_STACK_TOP;
 
     // 内核参数
-    char** argvk = (char**)alloc_kpage(1);
+    char** argvk = (char**)try_alloc_kpage(1);
+    if (!argvk)
+    {
+        free_kpage(pages, ARGS_PAGES);
+        return 0;
+    }
     // NULL 结尾
     argvk[argc] = NULL;
 
@@ -391,49 +401,62 @@ static u32 copy_argv_envp(char* filename, char* argv[], char* envp[])
 
     assert((u32)ktop > pages);
 
-    // 将参数和环境变量拷贝到用户栈
-    len = (pages_end - (u32)ktop);
-    utop = (char* )(USER_STACK_TOP - len);
-    memcpy(utop, ktop, len);
-
     // 释放内存
     free_kpage((u32)argvk, 1);
-    free_kpage(pages, 4);
 
+    *size = pages_end - (u32)ktop;
+    return pages;
+}
+
+// 将构造好的参数和环境变量拷贝到用户栈，释放内核页，返回用户栈顶
+static u32 copy_argv_envp(u32 pages, u32 len)
+{
+    char* ktop = (char*)(pages + ARGS_PAGES * PAGE_SIZE - len);
+    char* utop = (char*)(USER_STACK_TOP - len);
+    memcpy(utop, ktop, len);
+
+    free_kpage(pages, ARGS_PAGES);
     return (u32)utop;
 }
 
 extern int sys_brk();
 
-int sys_execve(char* filename, char* argvp[], char* envp[])
+// 找到可执行的常规文件，失败返回 NULL
+static inode_t* exec_inode(char* filename)
 {
     inode_t* inode = namei(filename);
-    int ret = EOF;
     if (!inode)
-        goto rollback;
-    
-    // 不是常规文件
-    if (!ISFILE(inode->desc->mode))
-        goto rollback;
+        return NULL;
 
-    // 文件不可执行
-    if (!permission(inode, P_EXEC))
-        goto rollback;
+    // 不是常规文件，或者文件不可执行
+    if (!ISFILE(inode->desc->mode) || !permission(inode, P_EXEC))
+    {
+        iput(inode);
+        return NULL;
+    }
+    return inode;
+}
 
+// 在当前地址空间加载程序并进入用户态，只有失败才返回
+static int task_execve(inode_t* inode, u32 pages, u32 len)
+{
     task_t* task = running_task();
-    strncpy(task->name, filename, TASK_NAME_LEN);
 
-    // 处理参数和环境变量
-    u32 top = copy_argv_envp(filename, argvp, envp);    
-
-    // 释放原程序的堆内存
+    // 释放原程序的堆内存与文件映射区域
     task->end = USER_EXEC_ADDR;
     sys_brk(USER_EXEC_ADDR);
+    region_clear(task);
 
     // 加载程序
     u32 entry = load_elf(inode);
     if (entry == EOF)
-        goto rollback;
+    {
+        // 去掉已经记录的段
+        region_clear(task);
+        free_kpage(pages, ARGS_PAGES);
+        iput(inode);
+        return EOF;
+    }
 
     // 设置堆内存地址
     sys_brk((u32)(task->end));
@@ -441,6 +464,9 @@ int sys_execve(char* filename, char* argvp[], char* envp[])
     iput(task->iexec);
     task->iexec = inode;
 
+    // 处理参数和环境变量
+    u32 top = copy_argv_envp(pages, len);
+
     intr_frame_t* iframe = (intr_frame_t*)((u32)task + PAGE_SIZE - sizeof(intr_frame_t));
     // 动态链接器地址
     iframe->edx = 0;
@@ -452,8 +478,85 @@ int sys_execve(char* filename, char* argvp[], char* envp[])
         "movl %0, %%esp\n"
         "jmp interrupt_exit\n" ::"m"(iframe)
     );
+}
 
-rollback:
-    iput(inode);
+int sys_execve(char* filename, char* argvp[], char* envp[])
+{
+    inode_t* inode = exec_inode(filename);
+    if (!inode)
+        return EOF;
+
+    // 处理参数和环境变量，先保存到内核中
+    u32 len;
+    u32 pages = build_argv_envp(filename, argvp, envp, &len);
+    if (!pages)
+    {
+        iput(inode);
+        return EOF;
+    }
+
+    // vfork 的子进程到这里才拥有自己的地址空间，失败时还在借用父进程的
+    task_t* task = running_task();
+    bool vfork = task->vfork;
+    if (vfork && task_vfork_exec(task) < 0)
+    {
+        free_kpage(pages, ARGS_PAGES);
+        iput(inode);
+        return EOF;
+    }
+    strncpy(task->name, filename, TASK_NAME_LEN);
+
+    int ret = task_execve(inode, pages, len);
+
+    // vfork 的子进程已经把地址空间还给父进程，加载失败只能退出
+    if (vfork)
+        task_exit(ret);
     return ret;
-}
\ No newline at end of file
+}
+
+// spawn 的子进程加载程序需要的参数
+typedef struct spawn_args_t
+{
+    inode_t* inode;
+    u32 pages;
+    u32 len;
+} spawn_args_t;
+
+// spawn 的子进程从这里开始执行，此时已经在子进程自己的地址空间中
+static void spawn_entry(spawn_args_t* args)
+{
+    inode_t* inode = args->inode;
+    u32 pages = args->pages;
+    u32 len = args->len;
+    kfree(args);
+
+    task_execve(inode, pages, len);
+    task_exit(-1);
+}
+
+// 直接从 ELF 文件创建子进程，不复制父进程的地址空间
+pid_t sys_spawn(char* filename, char* argv[], char* envp[], spawn_action_t* actions)
+{
+    inode_t* inode = exec_inode(filename);
+    if (!inode)
+        return EOF;
+
+    spawn_args_t* args = (spawn_args_t*)kmalloc(sizeof(spawn_args_t));
+    args->inode = inode;
+    args->pages = build_argv_envp(filename, argv, envp, &args->len);
+    if (!args->pages)
+    {
+        kfree(args);
+        iput(inode);
+        return EOF;
+    }
+
+    pid_t pid = task_spawn(filename, (target_t)spawn_entry, args, actions);
+    if (pid == EOF)
+    {
+        free_kpage(args->pages, ARGS_PAGES);
+        kfree(args);
+        iput(inode);
+    }
+    return pid;
+}
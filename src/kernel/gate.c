@@ -56,6 +56,7 @@ extern int32 console_write(void* dev, char* buf, u32 count);
 extern u32 sys_write(fd_t fd, char* buf, u32 count);
 extern u32 sys_read(fd_t fd, char* buf, u32 count);
 extern int sys_lseek(fd_t fd, off_t offset, int whence);
+extern int sys_ioctl(fd_t fd, int cmd, void* args);
 
 extern pid_t sys_getpid();
 extern pid_t sys_getppid();
@@ -92,14 +93,22 @@ extern int sys_mkfs(char* devname, int icount);
 extern int32 sys_brk(void* addr);
 extern void* sys_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset);
 extern int sys_munmap(void* addr, size_t length);
+extern int sys_msync(void* addr, size_t length, int flags);
 
 extern int sys_execve(char* filename, char* argvp[], char* envp[]);
+extern pid_t sys_spawn(char* filename, char* argv[], char* envp[], spawn_action_t* actions);
 
 extern fd_t sys_dup(fd_t oldfd);
 extern fd_t sys_dup2(fd_t oldfd, fd_t newfd);
 
 extern int sys_pipe(fd_t pipefd[2]);
 
+extern int sys_clock_stat(clock_stat_t* stat);
+extern int sys_clock_gettime(int clockid, timespec* tp);
+
+extern int sys_memory_stat(memory_stat_t* stat);
+extern int sys_slab_stat(slab_stat_t* stats, int count);
+
 void syscall_init()
 {
     for (size_t i = 0; i < SYSCALL_SIZE; ++i)
@@ -110,6 +119,7 @@ void syscall_init()
     syscall_table[SYS_NR_TEST] = sys_test;
     syscall_table[SYS_NR_EXIT] = task_exit;
     syscall_table[SYS_NR_FORK] = task_fork;
+    syscall_table[SYS_NR_VFORK] = task_vfork;
     syscall_table[SYS_NR_WAITPID] = task_waitpid;
     syscall_table[SYS_NR_TIME] = sys_time;
     syscall_table[SYS_NR_BRK] = sys_brk;
@@ -128,6 +138,7 @@ void syscall_init()
     syscall_table[SYS_NR_CLOSE] = sys_close;
     syscall_table[SYS_NR_CREATE] = sys_create;
     syscall_table[SYS_NR_LSEEK] = sys_lseek;
+    syscall_table[SYS_NR_IOCTL] = sys_ioctl;
     syscall_table[SYS_NR_GETCWD] = sys_getcwd;
     syscall_table[SYS_NR_CHROOT] = sys_chroot;
     syscall_table[SYS_NR_CHDIR] = sys_chdir;
@@ -141,8 +152,15 @@ void syscall_init()
     syscall_table[SYS_NR_MKFS] = sys_mkfs;
     syscall_table[SYS_NR_MMAP] = sys_mmap;
     syscall_table[SYS_NR_MUNMAP] = sys_munmap;
+    syscall_table[SYS_NR_MSYNC] = sys_msync;
     syscall_table[SYS_NR_EXECVE] = sys_execve;
+    syscall_table[SYS_NR_SPAWN] = sys_spawn;
     syscall_table[SYS_NR_DUP] = sys_dup;
     syscall_table[SYS_NR_DUP2] = sys_dup2;
     syscall_table[SYS_NR_PIPE] = sys_pipe;
+    syscall_table[SYS_NR_CLOCK_STAT] = sys_clock_stat;
+    syscall_table[SYS_NR_CLOCK_GETTIME] = sys_clock_gettime;
+    syscall_table[SYS_NR_NANOSLEEP] = task_nanosleep;
+    syscall_table[SYS_NR_MEMORY_STAT] = sys_memory_stat;
+    syscall_table[SYS_NR_SLAB_STAT] = sys_slab_stat;
 }
\ No newline at end of file
@@ -320,8 +320,8 @@ int ide_pio_ioctl(ide_disk_t *disk, int cmd, void *args, int flags)
     case DEV_CMD_SECTOR_COUNT:
         return disk->total_lba;
     default:
-        panic("device command %d can't recognize!!!", cmd);
-        break;
+        LOGK("device command %d can't recognize!!!\n", cmd);
+        return EOF;
     }
 }
 
@@ -346,9 +346,11 @@ int ide_pio_part_ioctl(ide_part_t *part, int cmd, void *args, int flags)
         return part->start;
     case DEV_CMD_SECTOR_COUNT:
         return part->count;
+    case DEV_CMD_PART_SYSTEM:
+        return part->system;
     default:
-        panic("device command %d can't recognize!!!", cmd);
-        break;
+        LOGK("device command %d can't recognize!!!\n", cmd);
+        return EOF;
     }
 }
 
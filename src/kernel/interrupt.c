@@ -92,6 +92,21 @@ void set_interrupt_mask(u32 irq, bool enable)
         outb(port, inb(port) | (1 << irq));
 }
 
+// 第 irq 号外中断已经发出请求，还没有被处理
+bool interrupt_pending(u32 irq)
+{
+    assert(irq >= 0 && irq < 16);
+    u16 port = PIC_M_CTRL;
+    if (irq >= 8)
+    {
+        port = PIC_S_CTRL;
+        irq -= 8;
+    }
+    // OCW3 读取中断请求寄存器 IRR
+    outb(port, 0x0a);
+    return (inb(port) >> irq) & 1;
+}
+
 // 默认外中断处理函数
 void default_handler(int vector)
 {
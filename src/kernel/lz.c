@@ -0,0 +1,190 @@
+#include <onix/lz.h>
+#include <string.h>
+#include <stdlib.h>
+
+// 最短的匹配长度
+#define LZ_MIN_MATCH 4
+
+// 哈希表大小，保存 4 字节序列上次出现的位置
+#define LZ_HASH_BITS 10
+
+// 标记中长度字段的最大值，超过时使用扩展长度字节
+#define LZ_LENGTH_MASK 15
+
+// 最大的匹配偏移
+#define LZ_MAX_OFFSET 0xffff
+
+// 只在关中断的内核中使用，不会重入
+static u16 lz_table[1 << LZ_HASH_BITS];
+
+static u32 lz_hash(u8* ptr)
+{
+    return (*(u32*)ptr * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// 写入扩展长度，每个字节 255 表示还有后续
+static u8* lz_put_length(u8* op, u8* oend, u32 length)
+{
+    while (length >= 255)
+    {
+        if (op >= oend)
+            return NULL;
+        *op++ = 255;
+        length -= 255;
+    }
+    if (op >= oend)
+        return NULL;
+    *op++ = length;
+    return op;
+}
+
+// 写入一个序列，match 为 0 表示最后一个只有字面量的序列，空间不足返回 NULL
+static u8* lz_put_sequence(u8* op, u8* oend, u8* literal, u32 count, u32 offset, u32 match)
+{
+    if (op >= oend)
+        return NULL;
+
+    u8* token = op++;
+    *token = MIN(count, LZ_LENGTH_MASK) << 4;
+    if (count >= LZ_LENGTH_MASK && !(op = lz_put_length(op, oend, count - LZ_LENGTH_MASK)))
+        return NULL;
+
+    if (op + count > oend)
+        return NULL;
+    memcpy(op, literal, count);
+    op += count;
+
+    if (!match)
+        return op;
+
+    if (op + 2 > oend)
+        return NULL;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+
+    match -= LZ_MIN_MATCH;
+    *token |= MIN(match, LZ_LENGTH_MASK);
+    if (match >= LZ_LENGTH_MASK && !(op = lz_put_length(op, oend, match - LZ_LENGTH_MASK)))
+        return NULL;
+    return op;
+}
+
+int lz_compress(u8* src, u32 len, u8* dst, u32 cap)
+{
+    u8* ip = src;
+    u8* anchor = src;   // 还没有输出的字面量开始的位置
+    u8* end = src + len;
+    u8* op = dst;
+    u8* oend = dst + cap;
+
+    // 表中的旧位置只是候选，匹配之前会比较内容
+    memset(lz_table, 0, sizeof(lz_table));
+
+    while (ip + LZ_MIN_MATCH <= end)
+    {
+        u32 h = lz_hash(ip);
+        u8* ref = src + lz_table[h];
+        lz_table[h] = ip - src;
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || *(u32*)ref != *(u32*)ip)
+        {
+            ip++;
+            continue;
+        }
+
+        u32 match = LZ_MIN_MATCH;
+        while (ip + match < end && ref[match] == ip[match])
+            match++;
+
+        op = lz_put_sequence(op, oend, anchor, ip - anchor, ip - ref, match);
+        if (!op)
+            return EOF;
+
+        ip += match;
+        anchor = ip;
+    }
+
+    op = lz_put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (!op)
+        return EOF;
+    return op - dst;
+}
+
+// 读取扩展长度，数据不完整返回 EOF
+static int lz_get_length(u8** ip, u8* end)
+{
+    u32 length = 0;
+    u8 byte;
+    do
+    {
+        if (*ip >= end)
+            return EOF;
+        byte = *(*ip)++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+int lz_decompress(u8* src, u32 len, u8* dst, u32 cap)
+{
+    u8* ip = src;
+    u8* end = src + len;
+    u8* op = dst;
+    u8* oend = dst + cap;
+
+    while (ip < end)
+    {
+        u8 token = *ip++;
+
+        int count = token >> 4;
+        if (count == LZ_LENGTH_MASK)
+        {
+            int more = lz_get_length(&ip, end);
+            if (more == EOF)
+                return EOF;
+            count += more;
+        }
+
+        if (ip + count > end || op + count > oend)
+            return EOF;
+        memcpy(op, ip, count);
+        ip += count;
+        op += count;
+
+        // 最后一个序列没有匹配
+        if (ip >= end)
+            break;
+
+        if (ip + 2 > end)
+            return EOF;
+        u32 offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        int match = token & LZ_LENGTH_MASK;
+        if (match == LZ_LENGTH_MASK)
+        {
+            int more = lz_get_length(&ip, end);
+            if (more == EOF)
+                return EOF;
+            match += more;
+        }
+        match += LZ_MIN_MATCH;
+
+        if (!offset || offset > op - dst || op + match > oend)
+            return EOF;
+
+        // 匹配可能与输出重叠，比如重复的短模式，只能逐字节拷贝
+        u8* ref = op - offset;
+        if (offset >= match)
+        {
+            memcpy(op, ref, match);
+            op += match;
+        }
+        else
+        {
+            while (match--)
+                *op++ = *ref++;
+        }
+    }
+    return op - dst;
+}
@@ -2,11 +2,19 @@
 
 extern void interrupt_init();
 extern void clock_init();
+extern void timer_init();
 extern void time_init();
 extern void rtc_init();
 extern void memory_map_init();
 extern void mapping_init();
+extern void buddy_init();
 extern void arena_init();
+extern void slab_init();
+extern void bitmap_check();
+extern void bitmap_bench();
+extern void arena_bench();
+extern void region_init();
+extern void request_init();
 extern void task_init();
 extern void syscall_init();
 extern void keyboard_init();
@@ -14,10 +22,13 @@ extern void tss_init();
 extern void ide_init();
 extern void serial_init();
 extern void buffer_init();
+extern void pcache_init();
+extern void swap_init();
 extern void super_init();
 extern void inode_init();
 extern void file_init();
 extern void ramdisk_init();
+extern void zram_init();
 extern void set_interrupt_state(bool state);
 extern void hang();
 
@@ -27,19 +38,30 @@ void kernel_init()
     interrupt_init();
     memory_map_init();
     mapping_init();
+    buddy_init();
     arena_init();
+    slab_init();
+    region_init();
+    bitmap_check();
+    bitmap_bench();
+    timer_init();
     clock_init();
+    arena_bench();
     keyboard_init();
     time_init();
     serial_init();
     // rtc_init(); 
+    request_init();
     ide_init();
     ramdisk_init();
+    zram_init();
 
     syscall_init();
     task_init();
 
     buffer_init();
+    pcache_init();
+    swap_init();
     file_init();
     inode_init();
     super_init();
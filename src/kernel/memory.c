@@ -7,10 +7,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ds/bitmap.h>
+#include <ds/list.h>
 #include <onix/multiboot2.h>
 #include <onix/syscall.h>
 #include <onix/fs.h>
 #include <onix/printk.h>
+#include <onix/interrupt.h>
+#include <onix/pcache.h>
+#include <onix/buffer.h>
+#include <onix/swap.h>
+#include <onix/slab.h>
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
@@ -31,6 +37,9 @@
 
 #define PDE_MASK 0xffc00000
 
+// 一个页表映射的内存大小 4M
+#define TABLE_SIZE 0x400000
+
 // 内核页表索引
 static u32 KERNEL_PAGE_TABLE[] = {
     0x2000,
@@ -136,15 +145,205 @@ static u32 start_page = 0;  // 可分配物理内存起始位置
 static u8* memory_map;     // 物理内存数组，每个字节来管理一个物理页
 static u32 memory_map_pages;// 物理内存数组占用的页数量
 
+// 伙伴系统的阶数，0 ~ 10，最大的块为 2^10 页，即 4M
+#define BUDDY_ORDER_NR 11
+// 表示该页不是空闲块的第一页
+#define BUDDY_INVALID 0xff
+
+// 同一阶的空闲块
+typedef struct free_area_t
+{
+    list_t free_list;   // 空闲块链表，链接的是块第一页的节点
+    u32 count;          // 空闲块数量
+} free_area_t;
+
+static free_area_t free_area[BUDDY_ORDER_NR];
+static u8* page_order;          // 每个物理页作为空闲块第一页时块的阶数
+static list_node_t* page_node;  // 每个物理页对应的空闲链表节点
+
+// 内核虚拟页空闲区间的分级数量，第 i 级保存页数在 [2^i, 2^(i+1)) 之间的区间
+#define EXTENT_CLASS_NR 12
+
+static list_t extent_list[EXTENT_CLASS_NR]; // 每一级的空闲区间链表
+static u32 extent_mask;         // 非空分级的位图
+static u32 extent_base;         // 第一个内核虚拟页的索引
+static u32 extent_pages;        // 内核虚拟页的数量
+static u16* extent_head;        // 页作为空闲区间第一页时，区间的页数，否则为 0
+static u16* extent_tail;        // 页作为空闲区间最后一页时，区间的页数，否则为 0
+static list_node_t* extent_node;// 空闲区间第一页的链表节点
+static u32 extent_count;        // 空闲区间数量
+static u32 kernel_free_pages;   // 空闲内核虚拟页数量
+
+// 把 [idx, idx + count) 作为空闲区间放入对应分级
+static void extent_insert(u32 idx, u32 count)
+{
+    u32 offset = idx - extent_base;
+    u32 level = bit_last(count);
+
+    extent_head[offset] = count;
+    extent_tail[offset + count - 1] = count;
+    list_insert_after(&(extent_list[level].head), extent_node + offset);
+    extent_mask |= (1 << level);
+    extent_count++;
+}
+
+// 把以 idx 开始的空闲区间摘下，返回区间页数
+static u32 extent_remove(u32 idx)
+{
+    u32 offset = idx - extent_base;
+    u32 count = extent_head[offset];
+    u32 level = bit_last(count);
+    assert(count);
+
+    extent_head[offset] = 0;
+    extent_tail[offset + count - 1] = 0;
+    list_remove(extent_node + offset);
+    if (list_empty(&(extent_list[level])))
+        extent_mask &= ~(1 << level);
+    extent_count--;
+    return count;
+}
+
+// 分配 count 个连续的内核虚拟页，返回第一页的索引
+static u32 extent_alloc(u32 count)
+{
+    list_node_t* node = NULL;
+
+    // 向上取整的分级中，任意区间都足够大
+    u32 level = bit_last(count);
+    u32 upper = (count & (count - 1)) ? level + 1 : level;
+    u32 mask = upper < EXTENT_CLASS_NR ? extent_mask & ~((1 << upper) - 1) : 0;
+
+    if (mask)
+    {
+        node = extent_list[bit_first(mask)].head.next;
+    }
+    else if (extent_mask & (1 << level))
+    {
+        // 只能在向下取整的分级里找足够大的区间
+        list_t* list = extent_list + level;
+        for (list_node_t* ptr = list->head.next; ptr != &(list->tail); ptr = ptr->next)
+        {
+            if (extent_head[ptr - extent_node] >= count)
+            {
+                node = ptr;
+                break;
+            }
+        }
+    }
+
+    // 没有足够大的区间
+    if (!node)
+        return 0;
+
+    u32 idx = (node - extent_node) + extent_base;
+    u32 size = extent_remove(idx);
+
+    // 剩余部分放回
+    if (size > count)
+        extent_insert(idx + count, size - count);
+
+    kernel_free_pages -= count;
+    return idx;
+}
+
+// 释放以 idx 开始的 count 个内核虚拟页，与前后的空闲区间合并
+static void extent_free(u32 idx, u32 count)
+{
+    u32 offset = idx - extent_base;
+    kernel_free_pages += count;
+
+    // 前面紧挨着一个空闲区间
+    if (offset > 0 && extent_tail[offset - 1])
+    {
+        u32 prev = extent_tail[offset - 1];
+        extent_remove(idx - prev);
+        idx -= prev;
+        count += prev;
+    }
+
+    // 后面紧挨着一个空闲区间
+    offset = idx - extent_base + count;
+    if (offset < extent_pages && extent_head[offset])
+        count += extent_remove(idx + count);
+
+    extent_insert(idx, count);
+}
+
+// 输出内核虚拟页的碎片情况
+void kernel_extent_info()
+{
+    u32 largest = 0;
+    if (extent_mask)
+    {
+        // 最大的区间只可能在最高的非空分级中
+        list_t* list = extent_list + bit_last(extent_mask);
+        for (list_node_t* ptr = list->head.next; ptr != &(list->tail); ptr = ptr->next)
+            largest = MAX(largest, extent_head[ptr - extent_node]);
+    }
+    LOGK("Kernel free pages %d extents %d largest %d\n",
+         kernel_free_pages, extent_count, largest);
+}
+
+u32 kernel_free_page_count()
+{
+    return kernel_free_pages;
+}
+
+u32 memory_total_pages()
+{
+    return total_pages;
+}
+
+u32 memory_free_pages()
+{
+    return free_pages;
+}
+
+// 内核虚拟页空闲区间初始化，管理数据放在 memory_map 之后
+static void extent_init()
+{
+    extent_base = IDX(MEMORY_BASE);
+    extent_pages = IDX(KERNEL_MEMORY_SIZE) - extent_base;
+
+    extent_head = (u16*)(memory_base + memory_map_pages * PAGE_SIZE);
+    extent_tail = extent_head + extent_pages;
+    extent_node = (list_node_t*)(extent_tail + extent_pages);
+
+    u32 pages = div_round_up((u32)(extent_node + extent_pages) - (u32)extent_head, PAGE_SIZE);
+    memset(extent_head, 0, pages * PAGE_SIZE);
+
+    for (size_t i = 0; i < EXTENT_CLASS_NR; i++)
+        list_init(extent_list + i);
+    extent_mask = 0;
+    extent_count = 0;
+
+    // memory_map 与区间管理数据占用的页
+    u32 used = memory_map_pages + pages;
+    for (size_t i = 0; i < used; i++)
+        bitmap_set(&kernel_map, extent_base + i, true);
+
+    // 高速缓冲与虚拟磁盘也从这里分配
+    kernel_free_pages = extent_pages - used;
+    extent_insert(extent_base + used, kernel_free_pages);
+    LOGK("Kernel extent page count %d\n", pages);
+    kernel_extent_info();
+}
+
 // mmap 初始化
 void memory_map_init()
 {
     // 初始化物理内存数组，以字节为单位
     memory_map = (u8*)memory_base;
 
+    // 物理内存数组之后依次是伙伴系统的阶数数组与链表节点数组，节点按 4 字节对齐
+    page_order = memory_map + total_pages;
+    page_node = (list_node_t*)(((u32)(page_order + total_pages) + 3) & ~3);
+
     // 计算物理内存数组占用的页面数，即管理物理也的数据结构 memory_map 需要占据的页面数量
-    memory_map_pages = div_round_up(total_pages, PAGE_SIZE);
+    memory_map_pages = div_round_up((u32)(page_node + total_pages) - memory_base, PAGE_SIZE);
     LOGK("Memory map page count %d\n", memory_map_pages);
+    assert(memory_base + memory_map_pages * PAGE_SIZE <= KERNEL_MEMORY_SIZE);
 
     // 空闲页减少，因为用作 memory_map 使用
     free_pages -= memory_map_pages;
@@ -156,7 +355,8 @@ void memory_map_init()
     // MEMORY_BASE 之前的内存用作 gdt 与 idt 等结构
     start_page = IDX(MEMORY_BASE) + memory_map_pages;
     // 这些页面都被使用了一次，所以对应的 memory_map 都为 1
-    for (size_t i = 0; i < start_page; ++i)
+    // 内核的 16M 内存由内核虚拟页区间管理，同样为 1，不交给伙伴系统
+    for (size_t i = 0; i < IDX(KERNEL_MEMORY_SIZE); ++i)
         memory_map[i] = 1;
 
     LOGK("Total pages %d free pages %d\n", total_pages, free_pages);
@@ -164,29 +364,263 @@ void memory_map_init()
     // 初始化内核虚拟内存位图，需要 8 位对齐
     u32 length = (IDX(KERNEL_MEMORY_SIZE) - IDX(MEMORY_BASE)) / 8;
     bitmap_init(&kernel_map, (u8*)KERNEL_MAP_BITS, length, IDX(MEMORY_BASE));
-    bitmap_scan(&kernel_map, memory_map_pages);
+
+    // 初始化内核虚拟页空闲区间
+    extent_init();
 }
 
-// 分配一页物理内存
-static u32 get_page()
+// 将以 idx 开始的 2^order 个页作为空闲块放入链表
+static void buddy_push(u32 idx, u32 order)
 {
-    // 从 start_page 的位置开始找，因为之前的都被使用了
-    for (size_t i = start_page; i < total_pages; i++)
+    free_area_t* area = free_area + order;
+    page_order[idx] = order;
+    // 不使用 list_push，避免查重带来的遍历
+    list_insert_after(&(area->free_list.head), page_node + idx);
+    area->count++;
+}
+
+// 将以 idx 开始的空闲块从链表中摘下
+static void buddy_remove(u32 idx)
+{
+    free_area_t* area = free_area + page_order[idx];
+    list_remove(page_node + idx);
+    page_order[idx] = BUDDY_INVALID;
+    area->count--;
+}
+
+// 分配 2^order 个连续的页，返回第一页的索引，没有足够的连续页返回 0
+static u32 buddy_alloc(u32 order)
+{
+    // 找到第一个有空闲块的阶
+    u32 current = order;
+    while (current < BUDDY_ORDER_NR && list_empty(&(free_area[current].free_list)))
+        current++;
+
+    if (current == BUDDY_ORDER_NR)
+        return 0;
+
+    list_node_t* node = free_area[current].free_list.head.next;
+    u32 idx = node - page_node;
+    buddy_remove(idx);
+
+    // 块比需要的大，把后一半依次还给低一阶
+    while (current > order)
+    {
+        current--;
+        buddy_push(idx + (1 << current), current);
+    }
+    return idx;
+}
+
+// 释放以 idx 开始的 2^order 个页，与空闲的伙伴合并
+static void buddy_free(u32 idx, u32 order)
+{
+    while (order < BUDDY_ORDER_NR - 1)
+    {
+        // 伙伴块的第一页，两者只在第 order 位不同
+        u32 buddy = idx ^ (1 << order);
+        if (buddy < start_page || buddy >= total_pages)
+            break;
+
+        // 伙伴不空闲，或者被分裂了
+        if (page_order[buddy] != order)
+            break;
+
+        buddy_remove(buddy);
+        idx &= ~(1 << order);
+        order++;
+    }
+    buddy_push(idx, order);
+}
+
+// 预先清零的物理页池，空闲进程在后台填充
+#define ZERO_POOL_SIZE 64
+// 空闲页少于这个数量时不再填充，留给正常分配
+#define ZERO_POOL_RESERVE 256
+
+// 分配标志，要求返回清零的页面
+#define PAGE_ZERO 0x1
+
+static u32 zero_pool[ZERO_POOL_SIZE]; // 已清零页面的索引，这些页不在伙伴系统中，引用为 0
+static u32 zero_count;  // 池中页面数量
+static u32 zero_hits;   // 要求清零且池中有页的次数
+static u32 zero_misses; // 要求清零但池为空，只能同步清零的次数
+
+// 预先清零的内核页池，供 kmalloc 的大块与进程控制块使用
+// 内核页不在伙伴系统中，清零之后直接从内核虚拟页区间中分配出来放在池中
+#define KZERO_POOL_SIZE 16
+// 内核空闲页少于这个数量时不再填充
+#define KZERO_POOL_RESERVE 64
+
+static u32 kzero_pool[KZERO_POOL_SIZE]; // 已清零内核页的地址
+static u32 kzero_count;     // 池中页面数量
+static u32 kzero_hits;      // 要求一页清零的内核页且池中有页的次数
+static u32 kzero_misses;    // 要求一页清零的内核页但池为空的次数
+
+static bool kzero_pool_fill();
+
+static u32 tlb_invlpg;  // invlpg 刷新单页的次数
+static u32 tlb_full;    // 重新加载 cr3 整体刷新的次数
+
+static void entry_init(page_entry_t* entry, u32 index);
+static page_entry_t* get_pte(u32 vaddr, bool create);
+static void flush_tlb_all();
+
+// kmap 页表，所有进程的页目录共用
+static page_entry_t* kmap_table;
+static u32 kmap_top;                // 正在使用的槽数量
+static bool kmap_intr[KMAP_NR];     // 每个槽映射之前的中断状态
+
+void* kmap(u32 paddr)
+{
+    ASSERT_PAGE(paddr);
+    bool intr = interrupt_disable();
+
+    assert(kmap_top < KMAP_NR);
+    u32 slot = kmap_top++;
+    kmap_intr[slot] = intr;
+
+    // 不存在的页表项不会进入快表，映射之后不用刷新
+    page_entry_t* entry = kmap_table + slot;
+    entry_init(entry, IDX(paddr));
+    entry->user = false;
+
+    return (void*)(KMAP_ADDR + slot * PAGE_SIZE);
+}
+
+void kunmap(void* vaddr)
+{
+    // 只能释放最后一个映射
+    assert(kmap_top > 0);
+    u32 slot = --kmap_top;
+    assert((u32)vaddr == KMAP_ADDR + slot * PAGE_SIZE);
+
+    *(u32*)(kmap_table + slot) = 0;
+    flush_tlb((u32)vaddr);
+
+    set_interrupt_state(kmap_intr[slot]);
+}
+
+// 将物理页 paddr 临时映射到内核清零
+static void clear_page(u32 paddr)
+{
+    void* page = kmap(paddr);
+    memset(page, 0, PAGE_SIZE);
+    kunmap(page);
+}
+
+// 从清零池中取出一页，池为空返回 0
+static u32 zero_pool_get()
+{
+    if (!zero_count)
+        return 0;
+
+    u32 idx = zero_pool[--zero_count];
+    assert(!memory_map[idx]);
+    memory_map[idx] = 1;
+    free_pages--;
+    return PAGE(idx);
+}
+
+// 清零一个空闲页放入池中，没有需要做的工作时返回 false，由空闲进程调用
+bool zero_pool_fill()
+{
+    // 先填充内核页的池，再填充物理页的池
+    if (kzero_pool_fill())
+        return true;
+
+    if (zero_count >= ZERO_POOL_SIZE || free_pages - zero_count <= ZERO_POOL_RESERVE)
+        return false;
+
+    // 池中的页仍然算作空闲页，所以不修改 free_pages
+    bool intr = interrupt_disable();
+    u32 idx = buddy_alloc(0);
+    set_interrupt_state(intr);
+
+    if (!idx)
+        return false;
+
+    clear_page(PAGE(idx));
+
+    intr = interrupt_disable();
+    zero_pool[zero_count++] = idx;
+    set_interrupt_state(intr);
+    return true;
+}
+
+static u32 reclaim_pages(u32 count);
+
+// 分配 2^order 个连续的物理页
+static u32 get_pages(u32 order)
+{
+    assert(order < BUDDY_ORDER_NR);
+
+    u32 idx = buddy_alloc(order);
+
+    // 伙伴系统用完时，清零池中的页也可以用
+    if (!idx && !order && zero_count)
+        return zero_pool_get();
+
+    // 回收页缓存与进程的页面，回收期间可能阻塞，释放的页也可能被别人拿走
+    while (!idx && reclaim_pages(1 << order))
+        idx = buddy_alloc(order);
+
+    // 没有空闲内存
+    if (!idx)
+        panic("Out of Memory!!!");
+
+    u32 count = 1 << order;
+    for (size_t i = 0; i < count; i++)
+    {
+        assert(!memory_map[idx + i]);
+        memory_map[idx + i] = 1;
+    }
+    free_pages -= count;
+
+    // 根据索引得到页面起始地址
+    return PAGE(idx);
+}
+
+// 获取内存管理的统计信息
+int sys_memory_stat(memory_stat_t* stat)
+{
+    stat->zero_count = zero_count;
+    stat->zero_hits = zero_hits;
+    stat->zero_misses = zero_misses;
+    stat->kzero_count = kzero_count;
+    stat->kzero_hits = kzero_hits;
+    stat->kzero_misses = kzero_misses;
+    stat->tlb_invlpg = tlb_invlpg;
+    stat->tlb_full = tlb_full;
+    return 0;
+}
+
+// 分配一页物理内存，flags 有 PAGE_ZERO 时返回的页内容全为 0
+static u32 get_page(u32 flags)
+{
+    u32 page = 0;
+
+    if (flags & PAGE_ZERO)
     {
-        // 如果还存在空闲页
-        if (!memory_map[i])
+        page = zero_pool_get();
+        if (page)
         {
-            memory_map[i] = 1;
-            free_pages--;
-            // 根据索引得到页面起始地址
-            u32 page = PAGE(i);
-            LOGK("GET page 0x%p\n", page);
-            return page;
+            zero_hits++;
         }
+        else
+        {
+            zero_misses++;
+            page = get_pages(0);
+            clear_page(page);
+        }
+    }
+    else
+    {
+        page = get_pages(0);
     }
 
-    // 没有空闲内存
-    panic("Out of Memory!!!");
+    LOGK("GET page 0x%p\n", page);
+    return page;
 }
 
 // 释放一页物理内存
@@ -203,14 +637,97 @@ static void put_page(u32 addr)
     assert(memory_map[idx] >= 1);
     memory_map[idx]--;
 
-    // 如果释放后引用为 0，增加一个空闲页面
+    // 如果释放后引用为 0，增加一个空闲页面，还给伙伴系统
     if (!memory_map[idx])
+    {
         free_pages++;
+        buddy_free(idx, 0);
+    }
     
     assert(free_pages < total_pages);
     LOGK("PUT page 0x%p\n", addr);
 }
 
+// 释放 get_pages 分配的 2^order 个物理页，每页的引用单独计数
+static void put_pages(u32 addr, u32 order)
+{
+    for (size_t i = 0; i < (1 << order); i++)
+        put_page(addr + i * PAGE_SIZE);
+}
+
+// 输出伙伴系统每一阶的空闲块数量
+void buddy_info()
+{
+    LOGK("Buddy free pages %d\n", free_pages);
+    for (size_t i = 0; i < BUDDY_ORDER_NR; i++)
+    {
+        LOGK("Buddy order %2d free blocks %d\n", i, free_area[i].count);
+    }
+}
+
+// 伙伴系统自检，分配释放之后，每一阶的空闲块数量应该不变
+static void buddy_test()
+{
+    u32 counts[BUDDY_ORDER_NR];
+    u32 pages = free_pages;
+    for (size_t i = 0; i < BUDDY_ORDER_NR; i++)
+        counts[i] = free_area[i].count;
+
+    // 单页分配
+    u32 page0 = get_pages(0);
+    u32 page1 = get_pages(0);
+    assert(page0 != page1);
+    assert(memory_map[IDX(page0)] == 1 && memory_map[IDX(page1)] == 1);
+
+    // 多页分配，起始地址按块大小对齐
+    u32 block = get_pages(3);
+    assert((IDX(block) & 7) == 0);
+    for (size_t i = 0; i < 8; i++)
+        assert(memory_map[IDX(block) + i] == 1);
+    assert(free_pages == pages - 10);
+
+    // 引用计数大于 1 时不应该归还
+    memory_map[IDX(page0)]++;
+    put_page(page0);
+    assert(memory_map[IDX(page0)] == 1);
+    assert(page_order[IDX(page0)] == BUDDY_INVALID);
+
+    put_page(page1);
+    put_pages(block, 3);
+    put_page(page0);
+
+    // 全部合并回去
+    assert(free_pages == pages);
+    for (size_t i = 0; i < BUDDY_ORDER_NR; i++)
+        assert(counts[i] == free_area[i].count);
+
+    LOGK("Buddy test finish...\n");
+}
+
+// 伙伴系统初始化，需要在 mapping_init 之后，此时内核占用的页已经标记过
+void buddy_init()
+{
+    for (size_t i = 0; i < BUDDY_ORDER_NR; i++)
+    {
+        list_init(&(free_area[i].free_list));
+        free_area[i].count = 0;
+    }
+    memset(page_order, BUDDY_INVALID, total_pages);
+
+    // 把所有没有被使用的页逐个释放到伙伴系统，相邻的页会自动合并
+    free_pages = 0;
+    for (size_t i = start_page; i < total_pages; i++)
+    {
+        if (memory_map[i])
+            continue;
+        free_pages++;
+        buddy_free(i, 0);
+    }
+
+    buddy_test();
+    buddy_info();
+}
+
 // 获取 cr2 寄存器
 u32 get_cr2()
 {
@@ -230,13 +747,14 @@ void set_cr3(u32 pde)
     asm volatile("movl %%eax, %%cr3\n" ::"a"(pde));
 }
 
-// 将 cr00 寄存器最高位 PE 设置位 1，启动分页
+// 将 cr0 寄存器最高位 PG 设置位 1，启动分页
+// 同时设置 WP 位，内核写只读的用户页面也会触发缺页，写时复制对内核同样有效
 static _inline void enable_page()
 {
-    // 0b1000_0000_0000_0000_0000_0000_0000_0000
+    // 0b1000_0000_0000_0001_0000_0000_0000_0000
     asm volatile(
         "movl %cr0, %eax\n"
-        "orl $0x80000000, %eax\n"
+        "orl $0x80010000, %eax\n"
         "movl %eax, %cr0\n");
 }
 
@@ -252,7 +770,43 @@ static void entry_init(page_entry_t* entry, u32 index)
     entry->index = index;
 }
 
+// 页面被换出的页表项，不在内存中，index 是交换槽号，其余的位保持换出前的样子
+// 没有映射的页表项全部为 0
+static bool entry_swapped(page_entry_t* entry)
+{
+    return !entry->present && entry->index;
+}
+
 // 内存映射初始化
+// CPUID 1 号功能 edx 中的特性位
+#define CPUID_PSE (1 << 3)  // 支持 4M 页
+#define CPUID_PGE (1 << 13) // 支持全局页
+
+// cr4 寄存器中的控制位
+#define CR4_PSE (1 << 4)    // 开启 4M 页
+#define CR4_PGE (1 << 7)    // 开启全局页
+
+// 获取 CPUID 1 号功能的特性位
+static u32 cpu_features()
+{
+    u32 eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid\n"
+                 : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return edx;
+}
+
+static u32 get_cr4()
+{
+    u32 cr4;
+    asm volatile("movl %%cr4, %0\n" : "=r"(cr4));
+    return cr4;
+}
+
+static void set_cr4(u32 cr4)
+{
+    asm volatile("movl %0, %%cr4\n" ::"r"(cr4));
+}
+
 void mapping_init()
 {
     // 将 KERNEL_PAGE_DIR 的位置视为 page_entry_t，并且设置为 0
@@ -260,17 +814,42 @@ void mapping_init()
     page_entry_t* pde = (page_entry_t*)KERNEL_PAGE_DIR;
     memset(pde, 0, PAGE_SIZE);
 
+    // CPU 支持的话，内核映射使用 4M 页，并且设置为全局页，切换 cr3 时不刷新
+    u32 features = cpu_features();
+    bool pse = (features & CPUID_PSE) != 0;
+    bool pge = (features & CPUID_PGE) != 0;
+    LOGK("Kernel mapping 4M page %d global page %d\n", pse, pge);
+
+    if (pse)
+        set_cr4(get_cr4() | CR4_PSE);
+
     idx_t index = 0;
 
     // 对内核的每一个页面
     for (idx_t didx = 0; didx < (sizeof(KERNEL_PAGE_TABLE) / 4); didx++)
     {
+        page_entry_t* dentry = &pde[didx];
+
+        // 第一个 4M 仍然使用页表，第 0 页不映射，并且逻辑地址 0 用作临时映射
+        if (pse && didx)
+        {
+            entry_init(dentry, index);
+            // 只能被内核访问
+            dentry->user = 0;
+            // 页目录项直接映射 4M 页
+            dentry->pat = 1;
+            dentry->global = pge;
+
+            for (size_t tidx = 0; tidx < 1024; tidx++, index++)
+                memory_map[index] = 1;
+            continue;
+        }
+
         // 得到页面起始地址，并且清空页面
         page_entry_t* pte = (page_entry_t*)(KERNEL_PAGE_TABLE[didx]);
         memset(pte, 0, PAGE_SIZE);
 
         // 设置页目录项目
-        page_entry_t* dentry = &pde[didx];
         entry_init(dentry, IDX((u32)pte));
         // 只能被内核访问
         dentry->user = 0;
@@ -288,6 +867,7 @@ void mapping_init()
             entry_init(tentry, index);
             // 只能被内核访问
             tentry->user = 0;
+            tentry->global = pge;
             memory_map[index] = 1;
         }
     }
@@ -301,11 +881,22 @@ void mapping_init()
     page_entry_t* entry = &pde[1023];
     entry_init(entry, IDX(KERNEL_PAGE_DIR));
 
+    // kmap 的页表，映射在自映射之前的 4M，只能被内核访问
+    kmap_table = (page_entry_t*)alloc_kpage(1);
+    memset(kmap_table, 0, PAGE_SIZE);
+    entry = &pde[DIDX(KMAP_ADDR)];
+    entry_init(entry, IDX(kmap_table));
+    entry->user = 0;
+
     // 设置 cr3 
     set_cr3((u32)pde);
 
     // 开启分页有效
     enable_page();
+
+    // 开启分页之后再开启全局页
+    if (pge)
+        set_cr4(get_cr4() | CR4_PGE);
 }
 
 // 通过页目录最后一个表项找到页面，通过页面的最后一个表项找到页面
@@ -315,6 +906,62 @@ static page_entry_t* get_pde()
     return (page_entry_t*)(0xfffff000);
 }
 
+static void copy_page(u32 paddr, void* page);
+
+// fork 之后页表被父子进程共享，页目录项只读，修改页表之前先复制一份私有的页表
+static void unshare_table(page_entry_t* dentry, u32 didx)
+{
+    page_entry_t* table = (page_entry_t*)(PDE_MASK | (didx << 12));
+    bool intr = interrupt_disable();
+
+    // 修改引用计数之前先分配新的页表，分配时可能阻塞回收内存，
+    // 其他进程可能已经复制了自己的页表，醒来之后重新检查引用
+    u32 paddr = 0;
+    if (memory_map[dentry->index] > 1)
+        paddr = get_page(0);
+
+    // 先打开写权限，才能通过页目录的自映射修改页表
+    dentry->write = true;
+    flush_tlb((u32)table);
+
+    // 只剩自己在使用这个页表，直接拿来用
+    if (memory_map[dentry->index] > 1)
+    {
+        // 页表中的页面被两个页表引用，非共享页面都要写时复制
+        for (size_t tidx = 0; tidx < 1024; ++tidx)
+        {
+            page_entry_t* entry = table + tidx;
+            if (!entry->present)
+            {
+                // 换出的页面，两个页表都引用交换槽
+                if (entry_swapped(entry))
+                    swap_dup(entry->index);
+                continue;
+            }
+
+            assert(memory_map[entry->index] > 0);
+            if (!entry->shared)
+                entry->write = false;
+
+            memory_map[entry->index]++;
+            assert(memory_map[entry->index] < 255);
+        }
+
+        copy_page(paddr, table);
+        memory_map[dentry->index]--;
+        dentry->index = IDX(paddr);
+        LOGK("COPY page table for 0x%p\n", didx << 22);
+    }
+    else if (paddr)
+    {
+        put_page(paddr);
+    }
+
+    // 页目录项改变了，整个 4M 区域的快表都要刷新
+    flush_tlb_all();
+    set_interrupt_state(intr);
+}
+
 // 根据 vaddr 最高 10 位作为索引，作为页目录的索引，得到 vaddr 地址对应的页目录项
 static page_entry_t* get_pte(u32 vaddr, bool create)
 {
@@ -336,10 +983,14 @@ static page_entry_t* get_pte(u32 vaddr, bool create)
     {
         LOGK("Get and create page table entry ofr 0x%p\n", vaddr);
         // 申请一个页表
-        u32 page = get_page();
-        // 配置页目录项，指向 page 所在的页面
+        u32 page = get_page(PAGE_ZERO);
+        // 配置页目录项，指向 page 所在的页面，页面已经清零
         entry_init(entry, IDX(page));
-        memset(table, 0, PAGE_SIZE);
+    }
+    // 页表与其他进程共享
+    else if (!entry->write)
+    {
+        unshare_table(entry, idx);
     }
 
     return table;
@@ -359,6 +1010,53 @@ void flush_tlb(u32 vaddr)
 {
     asm volatile("invlpg (%0)" ::"r"(vaddr)
                  : "memory");
+    tlb_invlpg++;
+}
+
+// 重新加载 cr3，刷新所有非全局页的快表
+static void flush_tlb_all()
+{
+    set_cr3(get_cr3());
+    tlb_full++;
+}
+
+void tlb_gather_init(tlb_gather_t* tlb)
+{
+    tlb->count = 0;
+}
+
+void tlb_gather_add(tlb_gather_t* tlb, u32 vaddr)
+{
+    // 超过上限之后只记录数量，最后整体刷新
+    if (tlb->count < TLB_GATHER_MAX)
+        tlb->pages[tlb->count] = vaddr;
+    tlb->count++;
+}
+
+// 收集 [start, end) 中所有页的刷新
+static void tlb_gather_range(tlb_gather_t* tlb, u32 start, u32 end)
+{
+    if (IDX(end - start) > TLB_GATHER_MAX)
+    {
+        tlb->count += IDX(end - start);
+        return;
+    }
+    for (u32 page = start; page < end; page += PAGE_SIZE)
+        tlb_gather_add(tlb, page);
+}
+
+void tlb_gather_flush(tlb_gather_t* tlb)
+{
+    if (tlb->count > TLB_GATHER_MAX)
+    {
+        flush_tlb_all();
+    }
+    else
+    {
+        for (size_t i = 0; i < tlb->count; i++)
+            flush_tlb(tlb->pages[i]);
+    }
+    tlb->count = 0;
 }
 
 // 从位图中扫描 count 个连续的页
@@ -392,25 +1090,119 @@ static void reset_page(bitmap_t *map, u32 addr, u32 count)
 }
 
 // 分配 count 个连续的内核页
-u32 alloc_kpage(u32 count)
+// 分配内核页，内核内存不足时返回 0，由调用者处理
+u32 try_alloc_kpage(u32 count)
 {
     assert(count > 0);
-    u32 vaddr = scan_page(&kernel_map, count);
+    u32 index = extent_alloc(count);
+
+    // 内核内存不足时，让高速缓冲释放空闲的页再试
+    while (!index && buffer_shrink(count))
+        index = extent_alloc(count);
+
+    // 还不够时把清零池中的内核页还回去
+    if (!index && kzero_count)
+    {
+        while (kzero_count)
+            free_kpage(kzero_pool[--kzero_count], 1);
+        index = extent_alloc(count);
+    }
+
+    if (!index)
+        return 0;
+
+    // 位图只用来检查重复释放
+    for (size_t i = 0; i < count; i++)
+    {
+        assert(!bitmap_test(&kernel_map, index + i));
+        bitmap_set(&kernel_map, index + i, true);
+    }
+
+    u32 vaddr = PAGE(index);
     LOGK("ALLOC kernel pages 0x%p count %d\n", vaddr, count);
     return vaddr;
 }
 
-// 释放 count 个连续的内核页
-void free_kpage(u32 vaddr, u32 count)
+u32 alloc_kpage(u32 count)
 {
-    ASSERT_PAGE(vaddr);
-    assert(count > 0);
+    u32 vaddr = try_alloc_kpage(count);
+    if (!vaddr)
+        panic("Out of kernel memory!!!");
+    return vaddr;
+}
+
+// 分配 count 个清零的内核页，只有一页时可以直接从清零池中取
+u32 alloc_kpage_zero(u32 count)
+{
+    if (count == 1)
+    {
+        bool intr = interrupt_disable();
+        u32 vaddr = kzero_count ? kzero_pool[--kzero_count] : 0;
+        set_interrupt_state(intr);
+
+        if (vaddr)
+        {
+            kzero_hits++;
+            return vaddr;
+        }
+        kzero_misses++;
+    }
+
+    u32 vaddr = alloc_kpage(count);
+    memset((void*)vaddr, 0, count * PAGE_SIZE);
+    return vaddr;
+}
+
+// 清零一个内核页放入池中，没有需要做的工作时返回 false，由空闲进程调用
+static bool kzero_pool_fill()
+{
+    if (kzero_count >= KZERO_POOL_SIZE || kernel_free_pages <= KZERO_POOL_RESERVE)
+        return false;
+
+    // 空闲页足够，不会收缩高速缓冲
+    bool intr = interrupt_disable();
+    u32 vaddr = try_alloc_kpage(1);
+    set_interrupt_state(intr);
+
+    if (!vaddr)
+        return false;
+
+    // 页面还没有放入池中，清零时可以打开中断
+    memset((void*)vaddr, 0, PAGE_SIZE);
+
+    intr = interrupt_disable();
+    if (kzero_count < KZERO_POOL_SIZE)
+        kzero_pool[kzero_count++] = vaddr;
+    else
+        free_kpage(vaddr, 1);
+    set_interrupt_state(intr);
+    return true;
+}
+
+// 释放 count 个连续的内核页
+void free_kpage(u32 vaddr, u32 count)
+{
+    ASSERT_PAGE(vaddr);
+    assert(count > 0);
     reset_page(&kernel_map, vaddr, count);
+    extent_free(IDX(vaddr), count);
     LOGK("FREE  kernel pages 0x%p count %d\n", vaddr, count);
 }
 
-// 申请一块物理页，将 vaddr 映射上去物理内存
-void link_page(u32 vaddr)
+// 分配一页物理内存，内核通过 kmap 访问
+u32 alloc_page()
+{
+    return get_page(0);
+}
+
+// 释放物理页的一个引用，页面还被用户进程映射时，由最后一个引用释放
+void free_page(u32 paddr)
+{
+    put_page(paddr);
+}
+
+// 申请一块物理页，将 vaddr 映射上去物理内存，flags 为分配标志
+static void map_page(u32 vaddr, u32 flags)
 {
     ASSERT_PAGE(vaddr);
 
@@ -424,16 +1216,21 @@ void link_page(u32 vaddr)
     if (entry->present)
         return;
 
-    // 获得一张物理页面，将 entry 指向这个页面
-    u32 paddr = get_page();
+    // 获得一张物理页面，将 entry 指向这个页面，原来不存在的页表项不在快表中
+    u32 paddr = get_page(flags);
     entry_init(entry, IDX(paddr));
-    flush_tlb(vaddr);
 
     LOGK("LINK from 0x%p to 0x%p", vaddr, paddr);
 }
 
-// 去掉 vaddr 对应物理内存映射
-void unlink_page(u32 vaddr)
+// 申请一块物理页，将 vaddr 映射上去物理内存
+void link_page(u32 vaddr)
+{
+    map_page(vaddr, 0);
+}
+
+// 去掉 vaddr 对应物理内存映射，快表由 tlb 统一刷新
+static void unmap_page(u32 vaddr, tlb_gather_t* tlb)
 {
     ASSERT_PAGE(vaddr);
 
@@ -445,101 +1242,130 @@ void unlink_page(u32 vaddr)
 
     entry = get_entry(vaddr, false);
 
+    // 换出的页面，释放交换槽，不在快表中
+    if (entry_swapped(entry))
+    {
+        swap_free(entry->index);
+        *(u32*)entry = 0;
+        return;
+    }
+
     // 如果本来就没有映射关系
     if (!entry->present)
         return;
 
-    // 设置存在位为 0
-    entry->present = false;
-
     // 得到原来对应的物理地址
     u32 paddr = PAGE(entry->index);
     LOGK("UNLINK from 0x%p to 0x%p", vaddr, paddr);
+
+    // 整个表项清零，不留下像换出页面的表项
+    *(u32*)entry = 0;
     
     // 把这个页面释放掉
     put_page(paddr);
 
-    flush_tlb(vaddr);
+    tlb_gather_add(tlb, vaddr);
 }
 
-// 对 page 地址的一页拷贝一份，并且返回新页的物理地址，page 本身是虚拟地址
-static u32 copy_page(void* page)
+// 去掉 vaddr 对应物理内存映射
+void unlink_page(u32 vaddr)
 {
-    // 申请一页，返回的是物理地址的页索引
-    u32 paddr = get_page();
+    tlb_gather_t tlb;
+    tlb_gather_init(&tlb);
+    unmap_page(vaddr, &tlb);
+    tlb_gather_flush(&tlb);
+}
 
-    // 现在不能直接访问 paddr 的物理地址，必须先给一个映射
-    // 为了把 page 上的内容拷贝到 paddr 上，先把 paddr 映射到逻辑地址 0 处
-    page_entry_t* entry = get_pte(0, false);
-    entry_init(entry, IDX(paddr));
-    flush_tlb(0);
-    
-    // 再使用逻辑地址进行拷贝
-    memcpy((void*)0, (void*)page, PAGE_SIZE);
+// 释放 vaddr 所在的整个 4M 区域，页表被共享时只减少页表的引用
+static void unlink_table(u32 vaddr, tlb_gather_t* tlb)
+{
+    assert((vaddr & (TABLE_SIZE - 1)) == 0);
+
+    u32 didx = DIDX(vaddr);
+    page_entry_t* dentry = get_pde() + didx;
+    if (!dentry->present)
+        return;
+
+    // 最后一个使用页表的进程，释放其中的页面
+    if (memory_map[dentry->index] == 1)
+    {
+        page_entry_t* pte = (page_entry_t*)(PDE_MASK | (didx << 12));
+        for (size_t tidx = 0; tidx < 1024; tidx++)
+        {
+            page_entry_t* entry = pte + tidx;
+            if (entry->present)
+                put_page(PAGE(entry->index));
+            else if (entry_swapped(entry))
+                swap_free(entry->index);
+        }
+    }
+
+    put_page(PAGE(dentry->index));
+    dentry->present = false;
+
+    // 刷新整个 4M 区域
+    tlb_gather_range(tlb, vaddr, vaddr + TABLE_SIZE);
+    LOGK("UNLINK table 0x%p\n", vaddr);
+}
 
-    // 这个页面临时使用，其中的 Index 没有意义，所以这个存在位为 0
-    entry->present = false;
-    flush_tlb(0);
-    return paddr;
+// 把 page 地址的一页拷贝到物理页 paddr，page 本身是虚拟地址
+// 新页要由调用者事先分配，拷贝本身不会阻塞
+static void copy_page(u32 paddr, void* page)
+{
+    // 现在不能直接访问 paddr 的物理地址，必须先给一个临时映射
+    void* vaddr = kmap(paddr);
+    memcpy(vaddr, page, PAGE_SIZE);
+    kunmap(vaddr);
 }
 
-// 拷贝当前进程页目录
-page_entry_t* copy_pde()
+// 拷贝当前进程页目录到内核页 pde 中
+void copy_pde(page_entry_t* pde)
 {
     // task 为父进程
     task_t* task = running_task();
-    // pde 是逻辑地址，但前 8M 的内存就 vaddr = paddr，所以 pde 可直接返回给子进程使用
-    page_entry_t* pde = (page_entry_t*)alloc_kpage(1);
-    // 拷贝一份页目录
-    memcpy(pde, (void*)task->pde, PAGE_SIZE);
+    page_entry_t* ppde = (page_entry_t*)task->pde;
 
-    // 最后一项指向自己
-    page_entry_t* entry = pde + 1023;
-    entry_init(entry, IDX(pde));
-
-    // 遍历页目录，拷贝已经存在的页表，遍历的是子进程的页目录，其中的内容跟父进程一致
-    page_entry_t* dentry;
     // 0、1、2、3 是内核态占据的 16M 内存
-    for (size_t didx = (sizeof(KERNEL_PAGE_TABLE) / 4); didx < 1023; ++didx)
+    // 用户的页表不再复制，父子进程共享，页目录项设置为只读，谁先写这个 4M 区域谁复制页表
+    for (size_t didx = (sizeof(KERNEL_PAGE_TABLE) / 4); didx < DIDX(KMAP_ADDR); ++didx)
     {
-        // 两个页目录，内容完全一致
-        dentry = pde + didx;
+        page_entry_t* dentry = ppde + didx;
         if (!dentry->present)
             continue;
 
-        // 页目录项目存在指向的页表，pte 是页表逻辑地址（页表有两个逻辑地址！可用用 0xffc 开头连查两次页目录，或者直接前 8M paddr = vaddr）
-        // 父、子进程，两个页目录都指向这个页表地址
-        page_entry_t* pte = (page_entry_t*)(PDE_MASK | (didx << 12));
-
-        // 遍历页表
-        for (size_t tidx = 0; tidx < 1024; ++tidx)
-        {
-            entry = pte + tidx;
-            if (!entry->present)
-                continue;
+        dentry->write = false;
 
-            // 页表项存在指向的页面
-            assert(memory_map[entry->index] > 0);
+        // 页表的引用 + 1
+        assert(memory_map[dentry->index] > 0);
+        memory_map[dentry->index]++;
+        assert(memory_map[dentry->index] < 255);
+    }
 
-            // 若不是共享内存，设置为只读
-            if (!entry->shared)
-                entry->write = false;
+    // pde 是逻辑地址，但前 16M 的内存就 vaddr = paddr，所以 pde 可直接给子进程使用
+    // 拷贝一份页目录
+    memcpy(pde, (void*)ppde, PAGE_SIZE);
 
-            // 物理引用 + 1
-            memory_map[entry->index]++;
-            assert(memory_map[entry->index] < 255);
-        }
+    // 最后一项指向自己
+    page_entry_t* entry = pde + 1023;
+    entry_init(entry, IDX(pde));
 
-        // 拷贝这个页表，把逻辑地址 pte 这个页拷贝一份到 paddr 这个物理地址
-        u32 paddr = copy_page(pte);
+    // 父进程的页目录项也变成只读，刷新快表
+    set_cr3(task->pde);
+}
 
-        // 设置子进程的页目录项指向新的页表!!!
-        dentry->index = IDX(paddr);
-    }
+// 在内核页 pde 中创建只有内核映射的页目录，用于不复制父进程的新进程
+void create_pde(page_entry_t* pde)
+{
+    memset(pde, 0, PAGE_SIZE);
 
-    set_cr3(task->pde);
+    // 内核的页表所有进程共用
+    page_entry_t* kpde = (page_entry_t*)KERNEL_PAGE_DIR;
+    for (size_t didx = 0; didx < (sizeof(KERNEL_PAGE_TABLE) / 4); ++didx)
+        pde[didx] = kpde[didx];
+    pde[DIDX(KMAP_ADDR)] = kpde[DIDX(KMAP_ADDR)];
 
-    return pde;
+    // 最后一项指向自己
+    entry_init(pde + 1023, IDX(pde));
 }
 
 // 释放页目录
@@ -550,16 +1376,25 @@ void free_pde()
 
     page_entry_t* pde = get_pde();
 
-    for (size_t didx = (sizeof(KERNEL_PAGE_TABLE) / 4); didx < 1023; didx++)
+    for (size_t didx = (sizeof(KERNEL_PAGE_TABLE) / 4); didx < DIDX(KMAP_ADDR); didx++)
     {
         page_entry_t* dentry = pde + didx;
         if (!dentry->present)
             continue;
         
+        // 页表还被其他进程共享，其中的页面由最后一个进程释放
+        if (memory_map[dentry->index] > 1)
+        {
+            put_page(PAGE(dentry->index));
+            continue;
+        }
+
         page_entry_t* pte = (page_entry_t*)(PDE_MASK | (didx << 12));
         for (size_t tidx = 0; tidx < 1024; tidx++)
         {
             page_entry_t* entry = pte + tidx;
+            if (entry_swapped(entry))
+                swap_free(entry->index);
             if (!entry->present)
                 continue;
             
@@ -577,6 +1412,492 @@ void free_pde()
     LOGK("free pages %d\n", free_pages);
 }
 
+// 文件映射区域从缓存中分配
+static kmem_cache_t* region_cache;
+
+void region_init()
+{
+    region_cache = kmem_cache_create("region", sizeof(vm_region_t), NULL);
+}
+
+// 把区域按开始地址插入进程的区域链表，区域互不重叠
+static void region_insert(task_t* task, vm_region_t* region)
+{
+    list_t* list = &(task->regions);
+    list_node_t* node = list->head.next;
+    for (; node != &(list->tail); node = node->next)
+    {
+        vm_region_t* next = element_entry(vm_region_t, node, node);
+        if (region->start < next->start)
+            break;
+    }
+    list_insert_before(node, &(region->node));
+}
+
+// 从进程的区域链表中去掉区域并释放
+static void region_free(vm_region_t* region)
+{
+    list_remove(&(region->node));
+    iput(region->inode);
+    kmem_cache_free(region_cache, region);
+}
+
+// 为当前进程添加文件映射区域，内容在缺页时才读取
+void region_add(u32 start, u32 end, inode_t* inode, u32 offset, u32 file_end, u32 flags)
+{
+    ASSERT_PAGE(start);
+    ASSERT_PAGE(end);
+    assert(start < end && file_end <= end);
+
+    vm_region_t* region = kmem_cache_alloc(region_cache);
+    region->start = start;
+    region->end = end;
+    region->file_end = file_end;
+    region->offset = offset;
+    region->flags = flags;
+    region->inode = inode;
+    inode->count++;
+    region_insert(running_task(), region);
+}
+
+// fork 的子进程复制 task 的文件映射区域，增加 inode 的引用
+void region_fork(task_t* task, task_t* child)
+{
+    list_init(&(child->regions));
+
+    list_t* list = &(task->regions);
+    for (list_node_t* node = list->head.next; node != &(list->tail); node = node->next)
+    {
+        vm_region_t* region = element_entry(vm_region_t, node, node);
+        vm_region_t* copy = kmem_cache_alloc(region_cache);
+        *copy = *region;
+        copy->inode->count++;
+        list_insert_before(&(child->regions.tail), &(copy->node));
+    }
+}
+
+// 找到 vaddr 所在的文件映射区域，链表按开始地址排序
+static vm_region_t* region_find(task_t* task, u32 vaddr)
+{
+    list_t* list = &(task->regions);
+    for (list_node_t* node = list->head.next; node != &(list->tail); node = node->next)
+    {
+        vm_region_t* region = element_entry(vm_region_t, node, node);
+        if (vaddr < region->start)
+            break;
+        if (vaddr < region->end)
+            return region;
+    }
+    return NULL;
+}
+
+// 获取 vaddr 已经存在的页表项，不创建也不复制页表，没有返回 NULL
+static page_entry_t* find_entry(u32 vaddr)
+{
+    page_entry_t* dentry = get_pde() + DIDX(vaddr);
+    if (!dentry->present)
+        return NULL;
+
+    page_entry_t* entry = (page_entry_t*)(PDE_MASK | (DIDX(vaddr) << 12)) + TIDX(vaddr);
+    if (!entry->present)
+        return NULL;
+    return entry;
+}
+
+// 把共享映射在 [start, end) 中被写过的页写回文件
+static void region_sync(vm_region_t* region, u32 start, u32 end)
+{
+    if ((region->flags & (REGION_SHARED | REGION_WRITE)) != (REGION_SHARED | REGION_WRITE))
+        return;
+
+    start = MAX(start, region->start);
+    end = MIN(end, region->end);
+
+    tlb_gather_t tlb;
+    tlb_gather_init(&tlb);
+
+    for (u32 page = start; page < end; page += PAGE_SIZE)
+    {
+        page_entry_t* entry = find_entry(page);
+        if (!entry || !entry->dirty)
+            continue;
+
+        // 只写回文件范围之内的部分
+        u32 offset = region->offset + (page - region->start);
+        u32 size = region->inode->desc->size;
+        if (offset < size)
+            inode_write(region->inode, (char*)page, MIN(PAGE_SIZE, size - offset), offset);
+
+        // 页表可能与子进程共享，修改之前要复制
+        entry = get_entry(page, false);
+        entry->dirty = false;
+        tlb_gather_add(&tlb, page);
+        LOGK("SYNC page 0x%p\n", page);
+    }
+    tlb_gather_flush(&tlb);
+}
+
+// 释放进程所有的文件映射区域，共享映射的脏页先写回，已经映射的页面由页表管理
+void region_clear(task_t* task)
+{
+    list_t* list = &(task->regions);
+    while (!list_empty(list))
+    {
+        vm_region_t* region = element_entry(vm_region_t, node, list->head.next);
+        region_sync(region, region->start, region->end);
+        region_free(region);
+    }
+}
+
+// 从文件映射区域中去掉 [start, end)，共享映射的脏页先写回
+static void region_unmap(task_t* task, u32 start, u32 end)
+{
+    list_t* list = &(task->regions);
+    list_node_t* node = list->head.next;
+    while (node != &(list->tail))
+    {
+        vm_region_t* region = element_entry(vm_region_t, node, node);
+        node = node->next;
+
+        // 链表按开始地址排序，之后的区域都在 end 之后
+        if (end <= region->start)
+            break;
+        if (region->end <= start)
+            continue;
+
+        region_sync(region, start, end);
+
+        // 整个区域都去掉
+        if (start <= region->start && region->end <= end)
+        {
+            region_free(region);
+            continue;
+        }
+
+        // 去掉中间的部分，后半部分成为新的区域，插在这个区域之后
+        if (region->start < start && end < region->end)
+        {
+            vm_region_t* tail = kmem_cache_alloc(region_cache);
+            *tail = *region;
+            tail->start = end;
+            tail->offset += end - region->start;
+            tail->file_end = MAX(tail->file_end, end);
+            region->inode->count++;
+            list_insert_after(&(region->node), &(tail->node));
+            node = tail->node.next;
+        }
+
+        // 去掉尾部
+        if (region->start < start)
+        {
+            region->end = MIN(region->end, start);
+            region->file_end = MIN(region->file_end, region->end);
+            continue;
+        }
+
+        // 去掉头部
+        region->offset += end - region->start;
+        region->start = end;
+        region->file_end = MAX(region->file_end, end);
+    }
+}
+
+// 整页都来自文件的页，直接映射页缓存中的页面
+// 只读区域只读映射，私有可写区域写时复制，共享可写区域直接写页缓存
+static void region_share(vm_region_t* region, u32 page)
+{
+    page_t* cache = pcache_get(region->inode, IDX(region->offset + (page - region->start)));
+    u32 paddr = cache->paddr;
+
+    page_entry_t* entry = get_entry(page, true);
+    assert(!entry->present);
+    entry_init(entry, IDX(paddr));
+
+    memory_map[IDX(paddr)]++;
+    assert(memory_map[IDX(paddr)] < 255);
+    pcache_put(cache);
+
+    if (!(region->flags & REGION_WRITE))
+    {
+        entry->write = false;
+        entry->readonly = true;
+    }
+    else if (!(region->flags & REGION_SHARED))
+    {
+        entry->write = false;
+    }
+    else
+    {
+        entry->shared = true;
+    }
+    flush_tlb(page);
+    LOGK("SHARE page 0x%p to 0x%p\n", page, paddr);
+}
+
+// 给 page 映射物理页，并从文件中读取内容
+static void region_fill(vm_region_t* region, u32 page)
+{
+    // 文件中的字节数，剩下的部分是 .bss 需要填充 0
+    u32 count = 0;
+    if (page < region->file_end)
+        count = MIN(PAGE_SIZE, region->file_end - page);
+
+    // 整页文件内容，超过文件结尾的部分页缓存中本来就是 0
+    if (count == PAGE_SIZE)
+    {
+        region_share(region, page);
+        return;
+    }
+
+    // 完全不在文件中的页，直接用清零的页
+    map_page(page, count ? 0 : PAGE_ZERO);
+
+    if (count)
+    {
+        // 文件内容之后填充 0
+        int n = inode_read(region->inode, (char*)page, count, region->offset + (page - region->start));
+        n = MAX(n, 0);
+        memset((char*)page + n, 0, PAGE_SIZE - n);
+    }
+
+    page_entry_t* entry = get_entry(page, false);
+
+    // 如果区域不可写，设置为只读（代码段）
+    if (!(region->flags & REGION_WRITE))
+    {
+        entry->write = false;
+        entry->readonly = true;
+    }
+
+    // 共享映射，fork 之后也不写时复制
+    if (region->flags & REGION_SHARED)
+        entry->shared = true;
+
+    // 读文件写入了页面，清除脏位，之后用户的写才需要写回
+    entry->dirty = false;
+    flush_tlb(page);
+    LOGK("FILL page 0x%p\n", page);
+}
+
+// 文件映射区域缺页，顺带填充同一对齐窗口中相邻的页
+static void region_fault(vm_region_t* region, u32 vaddr)
+{
+    u32 size = FAULT_AROUND_PAGES * PAGE_SIZE;
+    u32 start = MAX(vaddr & ~(size - 1), region->start);
+    u32 end = MIN((vaddr & ~(size - 1)) + size, region->end);
+
+    // 先填充发生缺页的页
+    u32 fault = PAGE(IDX(vaddr));
+    region_fill(region, fault);
+
+    for (u32 page = start; page < end; page += PAGE_SIZE)
+    {
+        if (page == fault)
+            continue;
+
+        // 已经映射或者被换出的页不用填充
+        page_entry_t* entry = get_entry(page, true);
+        if (entry->present || entry_swapped(entry))
+            continue;
+        region_fill(region, page);
+    }
+}
+
+bool page_mapped(u32 paddr)
+{
+    return memory_map[IDX(paddr)] > 1;
+}
+
+// 页面回收的时钟指针，依次扫描每个进程的用户页面
+static pid_t reclaim_pid = 0;
+static u32 reclaim_vaddr = USER_EXEC_ADDR;
+
+static u32 reclaim_drops;   // 直接丢弃的干净页面数量
+static u32 reclaim_swaps;   // 写入交换分区的页面数量
+
+// 可以被回收页面的进程，内核进程与借用父进程地址空间的进程除外
+static bool reclaim_task(task_t* task)
+{
+    return task->pde != KERNEL_PAGE_DIR && !task->vfork && task->state != TASK_DIED;
+}
+
+// 没有被写过的页面丢弃之后可以重新得到：文件映射区域从文件读取，堆与栈是清零的页
+static bool reclaim_clean(task_t* task, u32 vaddr)
+{
+    if (region_find(task, vaddr))
+        return true;
+    return vaddr < task->brk || vaddr >= USER_STACK_BUTTOM;
+}
+
+// 检查 task 在 vaddr 的页面，table 是页表的物理地址，释放了页面返回 1
+// 最近访问过的页清除访问位再给一次机会，共享的页面不回收
+static u32 reclaim_page(task_t* task, u32 table, u32 vaddr)
+{
+    u32 paddr = 0;
+    u32 slot = 0;
+
+    page_entry_t* pte = kmap(table);
+    page_entry_t* entry = pte + TIDX(vaddr);
+
+    if (!entry->present || !entry->user || entry->shared || memory_map[entry->index] != 1)
+        goto done;
+
+    // 页表可能被几个进程共享，vaddr 都相同，当前进程的快表中也可能有
+    if (entry->accessed)
+    {
+        entry->accessed = false;
+        flush_tlb(vaddr);
+        goto done;
+    }
+
+    paddr = PAGE(entry->index);
+
+    // 干净的页面直接丢弃
+    if (!entry->dirty && reclaim_clean(task, vaddr))
+    {
+        *(u32*)entry = 0;
+        flush_tlb(vaddr);
+        reclaim_drops++;
+        goto done;
+    }
+
+    // 先把页表项改为换出，之后访问这一页的进程等待交换锁，写入完成再读回
+    if (swap_enabled() && (slot = swap_alloc()))
+    {
+        entry->present = false;
+        entry->index = slot;
+        flush_tlb(vaddr);
+        reclaim_swaps++;
+        goto done;
+    }
+    paddr = 0;
+
+done:
+    kunmap(pte);
+
+    if (!paddr)
+        return 0;
+
+    // 写入磁盘会阻塞，要在 kunmap 之后
+    if (slot)
+        swap_write(slot, paddr);
+    put_page(paddr);
+    return 1;
+}
+
+// 时钟算法扫描进程的页面，至多扫描两遍，第一遍清除的访问位第二遍才能回收
+static u32 reclaim_scan(u32 count)
+{
+    u32 freed = 0;
+    u32 rounds = 0;
+
+    // 换出的页表项修改与写入磁盘之间持有交换锁
+    if (swap_enabled())
+        swap_lock();
+
+    while (freed < count && rounds <= 2)
+    {
+        // 回收期间会阻塞，每次重新查找进程
+        task_t* task = task_next(reclaim_pid);
+        if (!task)
+        {
+            reclaim_pid = 0;
+            reclaim_vaddr = USER_EXEC_ADDR;
+            rounds++;
+            continue;
+        }
+
+        if (task->pid != reclaim_pid)
+        {
+            reclaim_pid = task->pid;
+            reclaim_vaddr = USER_EXEC_ADDR;
+        }
+
+        if (!reclaim_task(task) || reclaim_vaddr >= USER_STACK_TOP)
+        {
+            reclaim_pid++;
+            reclaim_vaddr = USER_EXEC_ADDR;
+            continue;
+        }
+
+        u32 vaddr = reclaim_vaddr;
+        page_entry_t* dentry = (page_entry_t*)task->pde + DIDX(vaddr);
+
+        // 没有页表的 4M 整个跳过
+        if (!dentry->present)
+        {
+            reclaim_vaddr = (vaddr & ~(TABLE_SIZE - 1)) + TABLE_SIZE;
+            continue;
+        }
+
+        reclaim_vaddr += PAGE_SIZE;
+        freed += reclaim_page(task, PAGE(dentry->index), vaddr);
+    }
+
+    if (swap_enabled())
+        swap_unlock();
+    return freed;
+}
+
+// 物理内存不足时回收 count 页，先回收页缓存，再回收进程的页面，返回回收的页数
+static u32 reclaim_pages(u32 count)
+{
+    u32 freed = pcache_shrink(count);
+    if (freed < count)
+        freed += reclaim_scan(count - freed);
+
+    LOGK("RECLAIM %d pages of %d\n", freed, count);
+    return freed;
+}
+
+// vaddr 的页面被换出时读回来，返回 false 表示不是换出的页面
+static bool swap_fault(u32 vaddr)
+{
+    page_entry_t* dentry = get_pde() + DIDX(vaddr);
+    if (!dentry->present)
+        return false;
+
+    page_entry_t* entry = (page_entry_t*)(PDE_MASK | (DIDX(vaddr) << 12)) + TIDX(vaddr);
+    if (!entry_swapped(entry))
+        return false;
+
+    // 持有交换锁时不能分配物理页，先分配好页面，共享的页表也先复制
+    u32 paddr = get_page(0);
+    entry = get_entry(vaddr, false);
+
+    swap_lock();
+
+    // 等待期间页面可能已经读回来了
+    if (entry_swapped(entry))
+    {
+        u32 slot = entry->index;
+        swap_read(slot, paddr);
+        swap_free(slot);
+
+        // 内容不一定与文件相同，设置脏位，不能当作干净的页丢弃
+        entry->index = IDX(paddr);
+        entry->present = true;
+        entry->accessed = true;
+        entry->dirty = true;
+        paddr = 0;
+        LOGK("SWAP in page 0x%p\n", vaddr);
+    }
+
+    swap_unlock();
+
+    if (paddr)
+        put_page(paddr);
+    return true;
+}
+
+// 输出页面回收的统计信息
+void reclaim_info()
+{
+    LOGK("Reclaim drops %d swaps %d free pages %d\n",
+         reclaim_drops, reclaim_swaps, free_pages);
+    swap_info();
+}
+
 // 缺页异常时，CPU 会自动压入错误码
 typedef struct page_error_code_t
 {
@@ -620,35 +1941,70 @@ void page_fault(
     {
         assert(code->write);
 
-        // 获取该虚拟地址对应的页表地址与页表表项
+        // 获取该虚拟地址对应的页表地址与页表表项，页表被共享时会先复制页表
         page_entry_t* entry = get_entry(vaddr, false);
 
         // 这个表项应该存在，页面有被使用
         assert(entry->present);
+
+        // 只是页表被共享，页面本身可写
+        if (entry->write)
+        {
+            LOGK("WRITE page table for 0x%p\n", vaddr);
+            return;
+        }
+
+        // 写只读的映射，比如 PROT_READ 的文件映射
+        if (entry->readonly)
+        {
+            printk("Segmentation Fault!!!\n");
+            task_exit(-1);
+        }
+
         // 不能是共享内存
         assert(!entry->shared);
-        // 只读内存页
-        assert(!entry->readonly);
 
-        // 判断该页面的使用次数
-        if (memory_map[entry->index] == 1)
-        {   
-            // 只被一个进程使用，那么直接把写允许打开
-            entry->write = true;
-            LOGK("WRITE page for 0x%p\n", vaddr);
-        }
-        else
+        // 多个进程同时拥有一个只读页面，其中一个进程想写
+        if (memory_map[entry->index] > 1)
         {
-            // 多个进程同时拥有一个只读页面，其中一个进程想写
-            // 获得虚拟地址对应的页面起始位置
-            void* page = (void*)PAGE(IDX(vaddr));
-            // 把这个页面拷贝一份，并且返回物理地址
-            u32 paddr = copy_page(page);
-            memory_map[entry->index]--;
-            entry_init(entry, IDX(paddr));
-            flush_tlb(vaddr);
-            LOGK("COPY page for 0x%p\n", vaddr);
+            // 先分配新页，分配时可能阻塞回收内存，醒来之后重新检查表项
+            // 页面可能被换出，其他进程也可能已经复制，只剩自己在使用
+            u32 paddr = get_page(0);
+            if (!entry->present || entry->write)
+            {
+                put_page(paddr);
+                return;
+            }
+
+            if (memory_map[entry->index] > 1)
+            {
+                // 获得虚拟地址对应的页面起始位置，把这个页面拷贝一份
+                u32 old = PAGE(entry->index);
+                copy_page(paddr, (void*)PAGE(IDX(vaddr)));
+                put_page(old);
+                entry_init(entry, IDX(paddr));
+                flush_tlb(vaddr);
+                LOGK("COPY page for 0x%p\n", vaddr);
+                return;
+            }
+            put_page(paddr);
         }
+
+        // 只被一个进程使用，那么直接把写允许打开
+        entry->write = true;
+        LOGK("WRITE page for 0x%p\n", vaddr);
+        return;
+    }
+
+    // 被换出到交换分区的页面，要在文件映射区域之前检查
+    if (!code->present && swap_fault(vaddr))
+        return;
+
+    // 文件映射区域，从文件读取
+    vm_region_t* region = region_find(task, vaddr);
+    if (!code->present && region)
+    {
+        region_fault(region, vaddr);
         return;
     }
 
@@ -656,8 +2012,8 @@ void page_fault(
     {
         // 获得页面起始地址
         u32 page = PAGE(IDX(vaddr));
-        // 申请一页内存映射
-        link_page(page);
+        // 申请一页清零的内存映射
+        map_page(page, PAGE_ZERO);
         // BMB;
         return;
     }
@@ -680,10 +2036,25 @@ int32 sys_brk(void* addr)
 
     if (old_brk > brk)
     {
-        for (u32 page = brk; page < old_brk; page += PAGE_SIZE)
-            unlink_page(page);
+        tlb_gather_t tlb;
+        tlb_gather_init(&tlb);
+
+        u32 page = brk;
+        while (page < old_brk)
+        {
+            // 整个 4M 区域都要释放，直接放掉页表，共享的页表不用复制
+            if ((page & (TABLE_SIZE - 1)) == 0 && page + TABLE_SIZE <= old_brk)
+            {
+                unlink_table(page, &tlb);
+                page += TABLE_SIZE;
+                continue;
+            }
+            unmap_page(page, &tlb);
+            page += PAGE_SIZE;
+        }
+        tlb_gather_flush(&tlb);
     }
-    else if (IDX(brk - old_brk) > free_pages)
+    else if (IDX(brk - old_brk) > free_pages + swap_free_slots())
     {
         return -1;
     }
@@ -701,20 +2072,50 @@ void* sys_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t off
     u32 vaddr = (u32)addr;
 
     task_t* task = running_task();
+
+    // 映射文件，偏移要对齐到页，共享的可写映射要求文件可写
+    file_t* file = NULL;
+    if (fd != EOF)
+    {
+        if (fd < 0 || fd >= TASK_FILE_NR || !task->files[fd])
+            return (void*)EOF;
+        file = task->files[fd];
+        if (!ISFILE(file->inode->desc->mode) || (offset & 0xfff))
+            return (void*)EOF;
+        if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && (file->flags & O_ACCMODE) == O_RDONLY)
+            return (void*)EOF;
+    }
+
     // 如果调用者没有指定要要映射的地址，默认为第一个空闲页
     if (!vaddr)
         vaddr = scan_page(task->vmap, count);
 
     assert(vaddr >= USER_MMAP_ADDR && vaddr < USER_STACK_BUTTOM);
 
+    // 设置映射位图
+    for (size_t i = 0; i < count; ++i)
+        bitmap_set(task->vmap, IDX(vaddr + PAGE_SIZE * i), true);
+
+    // 文件映射记录为区域，访问时缺页再从文件读取
+    if (file)
+    {
+        u32 rflags = 0;
+        if (prot & PROT_WRITE)
+            rflags |= REGION_WRITE;
+        if (flags & MAP_SHARED)
+            rflags |= REGION_SHARED;
+
+        u32 end = vaddr + count * PAGE_SIZE;
+        region_add(vaddr, end, file->inode, offset, end, rflags);
+        return (void*)vaddr;
+    }
+
     // 对每一个页面：
     for (size_t i = 0; i < count; ++i)
     {
         u32 page = vaddr + PAGE_SIZE * i;
-        // 给虚拟地址 page 映射一个物理页
-        link_page(page);
-        // 设置映射位图
-        bitmap_set(task->vmap, IDX(page), true);
+        // 给虚拟地址 page 映射一个清零的物理页
+        map_page(page, PAGE_ZERO);
 
         // 得到描述这个物理页的页表项
         page_entry_t* entry = get_entry(page, false);
@@ -735,13 +2136,7 @@ void* sys_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t off
         {
             entry->privat = true;
         }
-    }
-
-    // 如果指定了一个文件，将文件读入获得到的内存
-    if (fd != EOF)
-    {
-        lseek(fd, offset, SEEK_SET);
-        read(fd, (char*)vaddr, length);
+        flush_tlb(page);
     }
 
     return (void*)vaddr;
@@ -755,15 +2150,45 @@ int sys_munmap(void* addr, size_t length)
 
     ASSERT_PAGE(vaddr);
     u32 count = div_round_up(length, PAGE_SIZE);
+
+    // 文件映射先写回，再去掉区域
+    region_unmap(task, vaddr, vaddr + count * PAGE_SIZE);
     
+    tlb_gather_t tlb;
+    tlb_gather_init(&tlb);
+
     // 对每一个页面：
     for (size_t i = 0; i < count; ++i)
     {
         u32 page = vaddr + i * PAGE_SIZE;
-        unlink_page(page);
+        unmap_page(page, &tlb);
         assert(bitmap_test(task->vmap, IDX(page)));
         bitmap_set(task->vmap, IDX(page), false);
     }
 
+    // 所有页面去掉之后统一刷新快表
+    tlb_gather_flush(&tlb);
+
     return 0;
-}
\ No newline at end of file
+}
+
+// 把共享文件映射中被写过的页写回文件
+int sys_msync(void* addr, size_t length, int flags)
+{
+    task_t* task = running_task();
+    u32 vaddr = (u32)addr;
+    if (vaddr & 0xfff)
+        return EOF;
+
+    u32 end = vaddr + div_round_up(length, PAGE_SIZE) * PAGE_SIZE;
+    list_t* list = &(task->regions);
+    for (list_node_t* node = list->head.next; node != &(list->tail); node = node->next)
+    {
+        vm_region_t* region = element_entry(vm_region_t, node, node);
+        if (end <= region->start)
+            break;
+        if (vaddr < region->end)
+            region_sync(region, vaddr, end);
+    }
+    return 0;
+}
@@ -0,0 +1,328 @@
+#include <onix/pcache.h>
+#include <onix/fs.h>
+#include <onix/stat.h>
+#include <onix/buffer.h>
+#include <onix/memory.h>
+#include <onix/device.h>
+#include <onix/slab.h>
+#include <onix/debug.h>
+#include <onix/assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+// 哈希数量，应该是一个素数
+#define HASH_COUNT 127
+
+// 一页中的文件块数量
+#define PAGE_BLOCKS (PAGE_SIZE / BLOCK_SIZE)
+
+// page_t 结构体从缓存中分配
+static kmem_cache_t* page_cache;
+
+// 页缓存哈希表
+static list_t hash_table[HASH_COUNT];
+
+// 最近使用链表，头部是最近使用的页
+static list_t lru_list;
+
+// 页缓存最多的页数，超过时淘汰最久没有使用的页，内存不足时还会由 pcache_shrink 回收
+#define PCACHE_MEMORY_RATIO 2
+static u32 page_max;
+
+static u32 page_count;  // 缓存的页数
+static u32 hits;        // 命中次数
+static u32 misses;      // 从磁盘读取的次数
+static u32 evicts;      // 淘汰的次数
+
+// 哈希函数，参数是：inode 和页索引
+static u32 hash(inode_t* inode, idx_t index)
+{
+    return (((u32)inode >> 4) ^ index) % HASH_COUNT;
+}
+
+static page_t* get_from_hash_table(inode_t* inode, idx_t index)
+{
+    list_t* list = hash_table + hash(inode, index);
+    for (list_node_t* node = list->head.next; node != &(list->tail); node = node->next)
+    {
+        page_t* page = element_entry(page_t, hnode, node);
+        if (page->inode == inode && page->index == index)
+            return page;
+    }
+    return NULL;
+}
+
+// 读写页中 [begin, end) 号文件块，磁盘上连续的块合并为一次请求
+// 块设备请求可能阻塞，不能在 kmap 期间进行，数据经过一个内核页中转
+static void pcache_request(page_t* page, u32 begin, u32 end, u32 type)
+{
+    inode_t* inode = page->inode;
+    idx_t base = page->index * PAGE_BLOCKS;
+
+    char* bounce = (char*)alloc_kpage(1);
+    char* data = NULL;
+    u32 offset = begin * BLOCK_SIZE;
+    u32 size = (end - begin) * BLOCK_SIZE;
+
+    if (type == REQ_WRITE)
+    {
+        data = kmap(page->paddr);
+        memcpy(bounce + offset, data + offset, size);
+        kunmap(data);
+    }
+
+    idx_t first = 0;    // 连续块的第一个块号
+    u32 start = 0;      // 连续块在页中的位置
+    u32 count = 0;      // 连续块的数量
+    for (u32 i = begin; i <= end; i++)
+    {
+        idx_t nr = 0;
+        if (i < end)
+        {
+            // 写需要创建文件块，读只读取文件大小之内的块
+            if (type == REQ_WRITE)
+                nr = bmap(inode, base + i, true);
+            else if ((base + i) * BLOCK_SIZE < inode->desc->size)
+                nr = bmap(inode, base + i, false);
+
+            // 文件空洞读为 0
+            if (!nr)
+                memset(bounce + i * BLOCK_SIZE, 0, BLOCK_SIZE);
+        }
+
+        if (count && nr == first + count)
+        {
+            count++;
+            continue;
+        }
+
+        if (count)
+        {
+            device_request(inode->dev, bounce + start * BLOCK_SIZE,
+                           count * BLOCK_SECS, first * BLOCK_SECS, 0, type);
+        }
+
+        first = nr;
+        start = i;
+        count = nr ? 1 : 0;
+    }
+
+    if (type == REQ_READ)
+    {
+        data = kmap(page->paddr);
+        memcpy(data + offset, bounce + offset, size);
+        kunmap(data);
+    }
+    free_kpage((u32)bounce, 1);
+}
+
+// 从哈希表、inode 链表与最近使用链表中移除
+// inode 的最后一页被移除时，没有引用的 inode 随之释放
+static void pcache_remove(page_t* page)
+{
+    inode_t* inode = page->inode;
+    list_remove(&(page->hnode));
+    list_remove(&(page->inode_node));
+    list_remove(&(page->lru_node));
+    page->inode = NULL;
+    page_count--;
+
+    if (list_empty(&(inode->pages)))
+        inode_pages_empty(inode);
+}
+
+// 释放页，用户进程映射的页面由最后一个引用释放
+static void pcache_release(page_t* page)
+{
+    assert(!page->count && !page->inode);
+    free_page(page->paddr);
+    kmem_cache_free(page_cache, page);
+}
+
+// 缓存已满时，淘汰最久没有使用并且没有被引用的页
+// 映射给进程的页面不能淘汰，否则共享映射与 read/write 看到的不是同一页
+static void pcache_evict()
+{
+    if (page_count < page_max)
+        return;
+
+    for (list_node_t* node = lru_list.tail.prve; node != &(lru_list.head); node = node->prve)
+    {
+        page_t* page = element_entry(page_t, lru_node, node);
+        if (page->count || page_mapped(page->paddr))
+            continue;
+
+        LOGK("EVICT inode %d page %d\n", page->inode->nr, page->index);
+        pcache_remove(page);
+        pcache_release(page);
+        evicts++;
+        return;
+    }
+}
+
+page_t* pcache_get(inode_t* inode, idx_t index)
+{
+    assert(ISFILE(inode->desc->mode));
+
+    page_t* page = get_from_hash_table(inode, index);
+    if (page)
+    {
+        hits++;
+        page->count++;
+        list_remove(&(page->lru_node));
+        list_insert_after(&(lru_list.head), &(page->lru_node));
+
+        // 其他进程正在读取，等待读取完成
+        if (!page->vaild)
+        {
+            lock_acquire(&(page->lock));
+            lock_release(&(page->lock));
+        }
+        return page;
+    }
+
+    misses++;
+    pcache_evict();
+
+    page = kmem_cache_alloc(page_cache);
+    page->paddr = alloc_page();
+    page->inode = inode;
+    page->index = index;
+    page->count = 1;
+    page->vaild = false;
+    lock_init(&(page->lock));
+
+    // 先放入哈希表，读取时阻塞的话，其他进程可以找到这一页
+    list_insert_after(&(hash_table[hash(inode, index)].head), &(page->hnode));
+    list_insert_after(&(inode->pages.head), &(page->inode_node));
+    list_insert_after(&(lru_list.head), &(page->lru_node));
+    page_count++;
+
+    lock_acquire(&(page->lock));
+    pcache_request(page, 0, PAGE_BLOCKS, REQ_READ);
+    page->vaild = true;
+    lock_release(&(page->lock));
+
+    LOGK("READ inode %d page %d\n", inode->nr, index);
+    return page;
+}
+
+void pcache_put(page_t* page)
+{
+    if (!page)
+        return;
+
+    page->count--;
+    assert(page->count >= 0);
+
+    // 使用期间文件被截断，页已经不在缓存中
+    if (!page->count && !page->inode)
+        pcache_release(page);
+}
+
+// 访问 [addr, addr + len) 的每一页，kmap 之前先处理完缺页
+static void prefault(char* addr, u32 len, bool write)
+{
+    u32 end = (u32)addr + len;
+    for (u32 vaddr = (u32)addr; vaddr < end; vaddr = (vaddr & ~(PAGE_SIZE - 1)) + PAGE_SIZE)
+    {
+        volatile char* ptr = (char*)vaddr;
+        char ch = *ptr;
+        if (write)
+            *ptr = ch;
+    }
+}
+
+// 在页的 start 处与 buf 之间拷贝 len 个字节，kmap 期间关中断，不能缺页
+// 按 buf 的页逐段拷贝，每段缺页处理完之后马上拷贝，中间不会阻塞，页面不会被换出
+static void pcache_copy(page_t* page, char* buf, u32 start, u32 len, bool write)
+{
+    assert(page->vaild);
+    assert(start + len <= PAGE_SIZE);
+
+    while (len)
+    {
+        u32 count = MIN(len, PAGE_SIZE - ((u32)buf & (PAGE_SIZE - 1)));
+        prefault(buf, count, !write);
+
+        char* data = kmap(page->paddr);
+        if (write)
+            memcpy(data + start, buf, count);
+        else
+            memcpy(buf, data + start, count);
+        kunmap(data);
+
+        buf += count;
+        start += count;
+        len -= count;
+    }
+}
+
+void pcache_read(page_t* page, char* buf, u32 start, u32 len)
+{
+    pcache_copy(page, buf, start, len, false);
+}
+
+void pcache_write(page_t* page, char* buf, u32 start, u32 len)
+{
+    pcache_copy(page, buf, start, len, true);
+}
+
+void pcache_flush(page_t* page, u32 start, u32 end)
+{
+    assert(page->vaild && page->inode);
+    assert(start < end && end <= PAGE_SIZE);
+    pcache_request(page, start / BLOCK_SIZE, div_round_up(end, BLOCK_SIZE), REQ_WRITE);
+}
+
+void pcache_free(inode_t* inode)
+{
+    while (!list_empty(&(inode->pages)))
+    {
+        page_t* page = element_entry(page_t, inode_node, inode->pages.head.next);
+        pcache_remove(page);
+
+        // 还有进程在使用，由最后一个 pcache_put 释放
+        if (!page->count)
+            pcache_release(page);
+    }
+}
+
+u32 pcache_shrink(u32 count)
+{
+    u32 freed = 0;
+    list_node_t* node = lru_list.tail.prve;
+    while (freed < count && node != &(lru_list.head))
+    {
+        page_t* page = element_entry(page_t, lru_node, node);
+        node = node->prve;
+
+        // 映射给进程的页面，从缓存中去掉也不能释放内存
+        if (page->count || page_mapped(page->paddr))
+            continue;
+
+        LOGK("SHRINK inode %d page %d\n", page->inode->nr, page->index);
+        pcache_remove(page);
+        pcache_release(page);
+        evicts++;
+        freed++;
+    }
+    return freed;
+}
+
+void pcache_info()
+{
+    LOGK("Page cache pages %d max %d hits %d misses %d evicts %d\n",
+         page_count, page_max, hits, misses, evicts);
+}
+
+void pcache_init()
+{
+    page_cache = kmem_cache_create("page", sizeof(page_t), NULL);
+    page_max = memory_total_pages() / PCACHE_MEMORY_RATIO;
+    list_init(&lru_list);
+    for (size_t i = 0; i < HASH_COUNT; ++i)
+        list_init(hash_table + i);
+}
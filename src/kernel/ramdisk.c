@@ -5,20 +5,80 @@
 #include <onix/types.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #define SECTOR_SIZE 512
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
-#define RAMDISK_NR 4
+// 启动时创建的虚拟磁盘数量
+#define RAMDISK_BOOT_NR 4
+
+// 虚拟磁盘的最大数量，其余的运行时通过 DEV_CMD_RAMDISK_CREATE 创建
+#define RAMDISK_NR 8
+
+// 一页中的扇区数量
+#define PAGE_SECTORS (PAGE_SIZE / SECTOR_SIZE)
+
+// 启动时的虚拟磁盘总共可以使用物理内存的 1 / RAMDISK_MEMORY_RATIO
+#define RAMDISK_MEMORY_RATIO 8
+
+// 启动时虚拟磁盘总大小的范围
+#define RAMDISK_SIZE_MIN 0x400000
+#define RAMDISK_SIZE_MAX 0x4000000
+
+// 运行时创建的虚拟磁盘最大 64M，minix 文件系统的块号只有 16 位
+#define RAMDISK_CREATE_MAX 0x4000000
+
+// 虚拟磁盘的内存不能回收，空闲页不多于这么多时写入新页失败
+#define RAMDISK_RESERVE_PAGES 256
 
 typedef struct ramdisk_t
-{   
-    u8* start;      // 内存开始的位置
-    u32 size;       // 占用内存的大小
+{
+    u32* pages;     // 每一页内存的物理地址，第一次写入时才分配，0 表示没有写过
+    u32 size;       // 磁盘的大小
+    u32 used;       // 已经分配的页数
 } ramdisk_t;
 
 static ramdisk_t ramdisks[RAMDISK_NR];
+static u32 ramdisk_count;
+static u32 ramdisk_pages;   // 所有虚拟磁盘已经分配的页数
+static u32 ramdisk_limit;   // 所有虚拟磁盘最多可以分配的页数
+
+static int ramdisk_create(u32 size);
+
+// 释放 [lba, lba + count) 扇区，整页的内存还给系统，不满一页的部分清零
+static int ramdisk_discard(ramdisk_t* disk, idx_t lba, u32 count)
+{
+    if (lba + count > disk->size / SECTOR_SIZE || lba + count < lba)
+        return EOF;
+
+    while (count)
+    {
+        idx_t idx = lba / PAGE_SECTORS;
+        u32 offset = (lba % PAGE_SECTORS) * SECTOR_SIZE;
+        u32 sectors = MIN(count, PAGE_SECTORS - lba % PAGE_SECTORS);
+        u32 paddr = disk->pages[idx];
+
+        if (paddr && sectors == PAGE_SECTORS)
+        {
+            disk->pages[idx] = 0;
+            disk->used--;
+            ramdisk_pages--;
+            free_page(paddr);
+        }
+        else if (paddr)
+        {
+            char* page = kmap(paddr);
+            memset(page + offset, 0, sectors * SECTOR_SIZE);
+            kunmap(page);
+        }
+
+        lba += sectors;
+        count -= sectors;
+    }
+    return 0;
+}
 
 int ramdisk_ioctl(ramdisk_t* disk, int cmd, void* args, int flags)
 {
@@ -30,20 +90,94 @@ int ramdisk_ioctl(ramdisk_t* disk, int cmd, void* args, int flags)
     case DEV_CMD_SECTOR_COUNT:
         return disk->size / SECTOR_SIZE;
         break;
+    case DEV_CMD_DISCARD:
+    {
+        if (!args)
+            return EOF;
+        dev_range_t* range = (dev_range_t*)args;
+        return ramdisk_discard(disk, range->start, range->count);
+    }
+    case DEV_CMD_RAMDISK_CREATE:
+        return ramdisk_create((u32)args);
     default:
-        panic("cmd not founf!!!\n");
-        break;
+        LOGK("cmd %d not found!!!\n", cmd);
+        return EOF;
     }
 }
 
+// 在 buf 与以 lba 起始的 count 个扇区之间拷贝，逐页映射内存
+// 没有写过的页读为 0，第一次写入时分配，内存不足时返回 EOF
+static int ramdisk_copy(ramdisk_t* disk, void* buf, u8 count, idx_t lba, bool write)
+{
+    if ((lba + count) * SECTOR_SIZE > disk->size)
+        return EOF;
+
+    while (count)
+    {
+        idx_t idx = lba / PAGE_SECTORS;
+        u32 offset = (lba % PAGE_SECTORS) * SECTOR_SIZE;
+        u32 sectors = MIN(count, PAGE_SECTORS - lba % PAGE_SECTORS);
+        u32 len = sectors * SECTOR_SIZE;
+
+        if (!disk->pages[idx] && !write)
+        {
+            memset(buf, 0, len);
+        }
+        else
+        {
+            // 分配页面可能阻塞，要在 kmap 之前，新页的其余部分清零
+            if (!disk->pages[idx])
+            {
+                // 超过总数限制，或者剩下的空闲页要留给进程与页缓存
+                if (ramdisk_pages >= ramdisk_limit ||
+                    memory_free_pages() <= RAMDISK_RESERVE_PAGES)
+                {
+                    LOGK("ramdisk out of memory, used %d pages\n", ramdisk_pages);
+                    return EOF;
+                }
+
+                u32 paddr = alloc_page();
+                if (len < PAGE_SIZE)
+                {
+                    char* page = kmap(paddr);
+                    memset(page, 0, PAGE_SIZE);
+                    kunmap(page);
+                }
+
+                // 阻塞期间其他进程可能已经写了这一页
+                if (disk->pages[idx])
+                {
+                    free_page(paddr);
+                }
+                else
+                {
+                    disk->pages[idx] = paddr;
+                    disk->used++;
+                    ramdisk_pages++;
+                }
+            }
+
+            char* page = kmap(disk->pages[idx]);
+            if (write)
+                memcpy(page + offset, buf, len);
+            else
+                memcpy(buf, page + offset, len);
+            kunmap(page);
+        }
+
+        buf += len;
+        lba += sectors;
+        count -= sectors;
+    }
+    return 0;
+}
+
 // 以扇区为单位，读以 lba 起始的扇区，读 count 块
 int ramdisk_read(ramdisk_t* disk, void* buf, u8 count, idx_t lba)
 {
     // 从内存中读
-    void* addr = disk->start + lba * SECTOR_SIZE;
-    u32 len = count * SECTOR_SIZE;
-    assert(((u32)addr + len) < (KERNEL_RAMDISK_MEM + KERNEL_MEMORY_SIZE));
-    memcpy(buf, addr, len);
+    if (ramdisk_copy(disk, buf, count, lba, false) < 0)
+        return EOF;
     return count;
 }
 
@@ -51,31 +185,58 @@ int ramdisk_read(ramdisk_t* disk, void* buf, u8 count, idx_t lba)
 int ramdisk_write(ramdisk_t* disk, void* buf, u8 count, idx_t lba)
 {
     // 写入内存
-    void* addr = disk->start + lba * SECTOR_SIZE;
-    u32 len = count * SECTOR_SIZE;
-    assert(((u32)addr + len) < (KERNEL_RAMDISK_MEM + KERNEL_MEMORY_SIZE));
-    memcpy(addr, buf, len);
+    if (ramdisk_copy(disk, buf, count, lba, true) < 0)
+        return EOF;
     return count;
 }
 
+// 创建大小为 size 的虚拟磁盘，只分配页表，返回设备号，内核内存不足时返回 EOF
+static int ramdisk_create(u32 size)
+{
+    if (!size || size > RAMDISK_CREATE_MAX || ramdisk_count >= RAMDISK_NR)
+        return EOF;
+    size = div_round_up(size, PAGE_SIZE) * PAGE_SIZE;
+
+    ramdisk_t* ramdisk = ramdisks + ramdisk_count;
+
+    u32 count = size / PAGE_SIZE;
+    u32 array = div_round_up(count * sizeof(u32), PAGE_SIZE);
+    ramdisk->pages = (u32*)try_alloc_kpage(array);
+    if (!ramdisk->pages)
+        return EOF;
+    memset(ramdisk->pages, 0, array * PAGE_SIZE);
+    ramdisk->size = size;
+    ramdisk->used = 0;
+
+    char name[32];
+    sprintf(name, "md%c", ramdisk_count + 'a');
+    ramdisk_count++;
+
+    // 将内存磁盘封装为设备，传入控制、读写函数
+    dev_t dev = device_install(DEV_BLOCK, DEV_RAMDISK, ramdisk, name, 0,
+                               ramdisk_ioctl, ramdisk_read, ramdisk_write);
+    LOGK("ramdisk %s size 0x%p\n", name, size);
+    return dev;
+}
+
 int ramdisk_init()
 {
     LOGK("ramdisk init...\n");
 
-    // 总大小 / 虚拟磁盘数量
-    u32 size = KERNEL_RAMDISK_SIZE / RAMDISK_NR;
-    assert(size % SECTOR_SIZE == 0);
+    // 总大小按物理内存决定，再平均分给每个虚拟磁盘，内存在写入时才分配
+    u32 total = memory_total_pages() / RAMDISK_MEMORY_RATIO * PAGE_SIZE;
+    total = MAX(total, RAMDISK_SIZE_MIN);
+    total = MIN(total, RAMDISK_SIZE_MAX);
+    u32 size = total / RAMDISK_BOOT_NR;
+    assert(size % PAGE_SIZE == 0);
 
-    char name[32];
-    for (size_t i = 0; i < RAMDISK_NR; ++i)
+    // 所有虚拟磁盘合计最多使用启动时的空闲内存减去保留的部分
+    u32 free = memory_free_pages();
+    ramdisk_limit = free > RAMDISK_RESERVE_PAGES ? free - RAMDISK_RESERVE_PAGES : 0;
+
+    for (size_t i = 0; i < RAMDISK_BOOT_NR; ++i)
     {
-        ramdisk_t* ramdisk = ramdisks + i;
-        // 磁盘的起始地址为 RAMDISK_MEM + 这次的偏移
-        ramdisk->start = (u8*)(KERNEL_RAMDISK_MEM + size * i);
-        ramdisk->size = size;
-        sprintf(name, "md%c", i + 'a');
-        // 将内存磁盘封装为设备，传入控制、读写函数
-        device_install(DEV_BLOCK, DEV_RAMDISK, ramdisk, name, 0,
-                       ramdisk_ioctl, ramdisk_read, ramdisk_write);
+        int dev = ramdisk_create(size);
+        assert(dev != EOF);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,233 @@
+#include <onix/slab.h>
+#include <onix/arena.h>
+#include <onix/memory.h>
+#include <onix/assert.h>
+#include <onix/debug.h>
+#include <onix/onix.h>
+#include <string.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+// 每个缓存最多保留的空闲 slab 数量，多余的还给内核
+#define SLAB_EMPTY_MAX 1
+
+// 一个 slab 占一页内存，页开始保存 slab_t，之后是对象
+typedef struct slab_t
+{
+    kmem_cache_t* cache;    // 所属缓存
+    list_node_t node;       // 所在的 partial/full/empty 链表节点
+    void* free;             // 空闲对象链表
+    u32 inuse;              // 正在使用的对象数量
+    u32 magic;              // 魔数
+} slab_t;
+
+// 所有的缓存
+static list_t cache_list;
+
+// 取得对象中保存的下一个空闲对象
+#define FREE_NEXT(cache, object) (*(void**)((u32)(object) + (cache)->offset))
+
+// 对象所在的 slab
+static slab_t* get_object_slab(void* object)
+{
+    return (slab_t*)((u32)object & 0xfffff000);
+}
+
+// 将 slab 移到 list 链表
+static void slab_move(slab_t* slab, list_t* list)
+{
+    list_remove(&(slab->node));
+    list_insert_after(&(list->head), &(slab->node));
+}
+
+// 创建一个 slab，构造其中的对象并串成空闲链表
+static slab_t* slab_create(kmem_cache_t* cache)
+{
+    slab_t* slab = (slab_t*)alloc_kpage(1);
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free = NULL;
+    slab->magic = ONIX_MAGIC;
+    slab->node.prve = NULL;
+    slab->node.next = NULL;
+
+    // 倒序链接，使得分配的顺序是地址从低到高
+    u32 start = (u32)(slab + 1);
+    for (int i = cache->total - 1; i >= 0; i--)
+    {
+        void* object = (void*)(start + i * cache->size);
+        if (cache->ctor)
+            cache->ctor(object);
+        FREE_NEXT(cache, object) = slab->free;
+        slab->free = object;
+    }
+
+    cache->slab_count++;
+    LOGK("cache %s create slab 0x%p\n", cache->name, slab);
+    return slab;
+}
+
+// 销毁一个空闲的 slab
+static void slab_destroy(slab_t* slab)
+{
+    kmem_cache_t* cache = slab->cache;
+    assert(slab->inuse == 0);
+
+    list_remove(&(slab->node));
+    slab->magic = 0;
+    free_kpage((u32)slab, 1);
+
+    cache->slab_count--;
+    LOGK("cache %s destroy slab 0x%p\n", cache->name, slab);
+}
+
+// 创建对象缓存
+kmem_cache_t* kmem_cache_create(char* name, u32 size, cache_ctor_t ctor)
+{
+    assert(size > 0);
+
+    kmem_cache_t* cache = (kmem_cache_t*)kmalloc(sizeof(kmem_cache_t));
+    memset(cache, 0, sizeof(kmem_cache_t));
+
+    strncpy(cache->name, name, CACHE_NAME_LEN - 1);
+    cache->object_size = size;
+    cache->ctor = ctor;
+
+    // 按 4 字节对齐，至少要能放下空闲链表指针
+    cache->size = (size + 3) & ~3;
+    cache->offset = 0;
+
+    // 有构造函数时，空闲链表指针放在对象之后，不破坏构造好的状态
+    if (ctor)
+    {
+        cache->offset = cache->size;
+        cache->size += sizeof(void*);
+    }
+
+    cache->total = (PAGE_SIZE - sizeof(slab_t)) / cache->size;
+    assert(cache->total > 0);
+
+    list_init(&(cache->partial));
+    list_init(&(cache->full));
+    list_init(&(cache->empty));
+    list_push(&cache_list, &(cache->node));
+
+    LOGK("cache %s object size %d per slab %d\n", cache->name, size, cache->total);
+    return cache;
+}
+
+// 销毁对象缓存
+void kmem_cache_destroy(kmem_cache_t* cache)
+{
+    assert(cache->active == 0);
+    assert(list_empty(&(cache->partial)));
+    assert(list_empty(&(cache->full)));
+
+    while (!list_empty(&(cache->empty)))
+    {
+        slab_t* slab = element_entry(slab_t, node, cache->empty.head.next);
+        slab_destroy(slab);
+    }
+
+    list_remove(&(cache->node));
+    kfree(cache);
+}
+
+// 从缓存中分配一个对象
+void* kmem_cache_alloc(kmem_cache_t* cache)
+{
+    slab_t* slab = NULL;
+
+    // 优先使用部分使用的 slab，其次是空闲的 slab，都没有再创建
+    if (!list_empty(&(cache->partial)))
+    {
+        slab = element_entry(slab_t, node, cache->partial.head.next);
+    }
+    else if (!list_empty(&(cache->empty)))
+    {
+        slab = element_entry(slab_t, node, cache->empty.head.next);
+        slab_move(slab, &(cache->partial));
+        cache->empty_count--;
+    }
+    else
+    {
+        slab = slab_create(cache);
+        list_insert_after(&(cache->partial.head), &(slab->node));
+    }
+
+    assert(slab->magic == ONIX_MAGIC);
+    assert(slab->free);
+
+    // 弹出第一个空闲对象
+    void* object = slab->free;
+    slab->free = FREE_NEXT(cache, object);
+    slab->inuse++;
+
+    // slab 用完了
+    if (!slab->free)
+        slab_move(slab, &(cache->full));
+
+    cache->active++;
+    cache->allocs++;
+    return object;
+}
+
+// 将对象释放回缓存
+void kmem_cache_free(kmem_cache_t* cache, void* object)
+{
+    assert(object);
+    slab_t* slab = get_object_slab(object);
+    assert(slab->magic == ONIX_MAGIC);
+    assert(slab->cache == cache);
+    assert(slab->inuse > 0);
+
+    // 原来是满的，现在有了空闲对象
+    if (!slab->free)
+        slab_move(slab, &(cache->partial));
+
+    FREE_NEXT(cache, object) = slab->free;
+    slab->free = object;
+    slab->inuse--;
+
+    cache->active--;
+    cache->frees++;
+
+    if (slab->inuse)
+        return;
+
+    // 全部空闲，保留少量空闲 slab，多余的释放掉
+    if (cache->empty_count < SLAB_EMPTY_MAX)
+    {
+        slab_move(slab, &(cache->empty));
+        cache->empty_count++;
+    }
+    else
+    {
+        slab_destroy(slab);
+    }
+}
+
+// 获取至多 count 个缓存的统计信息，返回写入的数量
+int sys_slab_stat(slab_stat_t* stats, int count)
+{
+    int n = 0;
+    list_t* list = &cache_list;
+    for (list_node_t* node = list->head.next; node != &(list->tail) && n < count; node = node->next)
+    {
+        kmem_cache_t* cache = element_entry(kmem_cache_t, node, node);
+        slab_stat_t* stat = stats + n++;
+        memcpy(stat->name, cache->name, CACHE_NAME_LEN);
+        stat->object_size = cache->object_size;
+        stat->slabs = cache->slab_count;
+        stat->active = cache->active;
+        stat->allocs = cache->allocs;
+        stat->frees = cache->frees;
+    }
+    return n;
+}
+
+// slab 初始化，在 arena_init 之后
+void slab_init()
+{
+    list_init(&cache_list);
+}
@@ -0,0 +1,163 @@
+#include <onix/swap.h>
+#include <onix/memory.h>
+#include <onix/device.h>
+#include <onix/mutex.h>
+#include <onix/task.h>
+#include <onix/debug.h>
+#include <onix/assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+#define SECTOR_SIZE 512
+
+// 一页的扇区数量
+#define PAGE_SECTORS (PAGE_SIZE / SECTOR_SIZE)
+
+typedef struct swap_t
+{
+    device_t* device;   // 交换分区
+    u32 slots;          // 交换槽数量，第 0 个槽不使用，0 表示没有换出
+    u8* map;            // 每个交换槽的引用计数
+    u32 free;           // 空闲的交换槽数量
+    u32 hand;           // 下一次开始查找空闲槽的位置
+    char* bounce;       // 磁盘读写经过的内核页，kmap 期间不能阻塞
+    lock_t lock;        // 交换锁
+} swap_t;
+
+static swap_t swap;
+
+static u32 swap_outs;   // 换出的页数
+static u32 swap_ins;    // 换入的页数
+
+bool swap_enabled()
+{
+    return swap.device != NULL;
+}
+
+u32 swap_free_slots()
+{
+    return swap.free;
+}
+
+u32 swap_alloc()
+{
+    if (!swap.free)
+        return 0;
+
+    // 从上次的位置继续找，连续换出的页放在相邻的槽中
+    for (size_t i = 0; i < swap.slots; i++)
+    {
+        u32 slot = swap.hand++;
+        if (swap.hand >= swap.slots)
+            swap.hand = 1;
+
+        if (slot && !swap.map[slot])
+        {
+            swap.map[slot] = 1;
+            swap.free--;
+            return slot;
+        }
+    }
+    panic("Swap map broken!!!");
+}
+
+void swap_dup(u32 slot)
+{
+    assert(slot && slot < swap.slots);
+    assert(swap.map[slot] > 0 && swap.map[slot] < 255);
+    swap.map[slot]++;
+}
+
+void swap_free(u32 slot)
+{
+    assert(slot && slot < swap.slots);
+    assert(swap.map[slot] > 0);
+    swap.map[slot]--;
+    if (!swap.map[slot])
+        swap.free++;
+}
+
+void swap_lock()
+{
+    lock_acquire(&swap.lock);
+}
+
+void swap_unlock()
+{
+    lock_release(&swap.lock);
+}
+
+void swap_write(u32 slot, u32 paddr)
+{
+    assert(swap.lock.holder == running_task());
+    assert(slot && slot < swap.slots);
+
+    char* page = kmap(paddr);
+    memcpy(swap.bounce, page, PAGE_SIZE);
+    kunmap(page);
+
+    device_request(swap.device->dev, swap.bounce, PAGE_SECTORS, slot * PAGE_SECTORS, 0, REQ_WRITE);
+    swap_outs++;
+    LOGK("SWAP out 0x%p to slot %d\n", paddr, slot);
+}
+
+void swap_read(u32 slot, u32 paddr)
+{
+    assert(swap.lock.holder == running_task());
+    assert(slot && slot < swap.slots);
+
+    device_request(swap.device->dev, swap.bounce, PAGE_SECTORS, slot * PAGE_SECTORS, 0, REQ_READ);
+
+    char* page = kmap(paddr);
+    memcpy(page, swap.bounce, PAGE_SIZE);
+    kunmap(page);
+
+    swap_ins++;
+    LOGK("SWAP in slot %d to 0x%p\n", slot, paddr);
+}
+
+void swap_info()
+{
+    LOGK("Swap slots %d free %d out %d in %d\n",
+         swap.slots, swap.free, swap_outs, swap_ins);
+}
+
+// 找到第一个交换类型的磁盘分区，没有就不换出页面
+void swap_init()
+{
+    lock_init(&swap.lock);
+
+    for (size_t i = 0; true; i++)
+    {
+        device_t* device = device_find(DEV_IDE_PART, i);
+        if (!device)
+            break;
+        if (device_ioctl(device->dev, DEV_CMD_PART_SYSTEM, NULL, 0) != SWAP_PART_SYSTEM)
+            continue;
+
+        swap.device = device;
+        break;
+    }
+
+    if (!swap.device)
+    {
+        LOGK("Swap partition not found...\n");
+        return;
+    }
+
+    u32 sectors = device_ioctl(swap.device->dev, DEV_CMD_SECTOR_COUNT, NULL, 0);
+    swap.slots = sectors / PAGE_SECTORS;
+    assert(swap.slots > 1);
+
+    u32 pages = div_round_up(swap.slots, PAGE_SIZE);
+    swap.map = (u8*)alloc_kpage(pages);
+    memset(swap.map, 0, pages * PAGE_SIZE);
+
+    swap.free = swap.slots - 1;
+    swap.hand = 1;
+    swap.bounce = (char*)alloc_kpage(1);
+
+    LOGK("Swap partition %s slots %d\n", swap.device->name, swap.slots);
+}
@@ -9,13 +9,25 @@
 #include <onix/syscall.h>
 #include <onix/global.h>
 #include <onix/arena.h>
+#include <onix/timer.h>
 #include <ds/bitmap.h>
 #include <string.h>
+#include <stdlib.h>
 #include <ds/list.h>
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
-#define NR_TASKS 64
+// pid 的最大数量，pid 通过位图分配
+#define PID_MAX 32768
+
+// pid 散列表初始的桶数量，任务数量超过桶数量的两倍时加倍
+#define PID_HASH_INIT (PAGE_SIZE / sizeof(task_t*))
+
+// 优先级的数量，优先级越大越先调度，同一优先级轮流执行
+#define PRIORITY_NR 32
+
+// nanosleep 一次在时间轮中睡眠的最多时间片，时间轮只能表示 31 位以内的未来
+#define NSLEEP_TICKS_MAX 0x40000000
 
 // 全局时间数量
 extern u32 volatile jiffies;
@@ -24,27 +36,143 @@ extern bitmap_t kernel_map;
 extern tss_t tss;
 extern void task_switch(task_t* next);
 extern file_t file_table[];
-
-static task_t* task_table[NR_TASKS];
+extern void clock_kick();
+extern void clock_catchup();
+extern u64 clock_monotonic();
+
+static u32 pid_map[PID_MAX / 32];   // pid 位图
+static pid_t pid_last;              // 上次分配的 pid，下次从它之后开始找
+static task_t** pid_hash;           // pid 散列表
+static u32 pid_hash_size;           // 散列表的桶数量，是 2 的幂
+static u32 task_count;              // 任务数量
 static list_t block_list;
 static list_t sleep_list;
 static task_t* idle_task;
 
-// 获取任务数组第一个空闲位置，并且构建一个返回
-static task_t* get_free_task()
+// 就绪队列，每个优先级一个链表，位图记录非空的优先级，运行的任务不在队列中
+static list_t run_queue[PRIORITY_NR];
+static u32 run_queue_map;
+
+// 分配一个 pid，从上次分配的之后开始找，没有返回 EOF
+static pid_t pid_alloc()
 {
-    for (size_t i = 0; i < NR_TASKS; ++i)
+    u32 start = (pid_last + 1) % PID_MAX;
+
+    // 最后再完整地检查一次开始的字
+    for (size_t i = 0; i <= PID_MAX / 32; ++i)
     {
-        if (task_table[i] == NULL)
+        u32 idx = (start / 32 + i) % (PID_MAX / 32);
+        u32 bits = pid_map[idx];
+        if (i == 0)
+            bits |= (1 << (start % 32)) - 1;
+        if (bits == 0xffffffff)
+            continue;
+
+        pid_t pid = idx * 32 + bit_first(~bits);
+        pid_map[idx] |= (1 << (pid % 32));
+        pid_last = pid;
+        return pid;
+    }
+    return EOF;
+}
+
+static void pid_free(pid_t pid)
+{
+    assert(pid_map[pid / 32] & (1 << (pid % 32)));
+    pid_map[pid / 32] &= ~(1 << (pid % 32));
+}
+
+// 通过 pid 找到任务，没有返回 NULL
+static task_t* task_find(pid_t pid)
+{
+    task_t* task = pid_hash[pid & (pid_hash_size - 1)];
+    while (task && task->pid != pid)
+        task = task->hash_next;
+    return task;
+}
+
+// 散列表的桶数量加倍，重新放入所有的任务
+static void pid_hash_grow()
+{
+    u32 size = pid_hash_size * 2;
+    u32 pages = size * sizeof(task_t*) / PAGE_SIZE;
+    // 内核内存不足时不扩展，只是链表长一些
+    task_t** table = (task_t**)try_alloc_kpage(pages);
+    if (!table)
+        return;
+    memset(table, 0, pages * PAGE_SIZE);
+
+    // 分配内存可能阻塞，其他进程可能已经扩展了散列表
+    if (size <= pid_hash_size)
+    {
+        free_kpage((u32)table, pages);
+        return;
+    }
+
+    for (size_t i = 0; i < pid_hash_size; ++i)
+    {
+        task_t* task = pid_hash[i];
+        while (task)
         {
-            task_t* task = (task_t*)alloc_kpage(1);
-            memset(task, 0, PAGE_SIZE);
-            task->pid = i;
-            task_table[i] = task;
-            return task;
+            task_t* next = task->hash_next;
+            u32 idx = task->pid & (size - 1);
+            task->hash_next = table[idx];
+            table[idx] = task;
+            task = next;
         }
     }
-    panic("No more tasks");
+
+    free_kpage((u32)pid_hash, pid_hash_size * sizeof(task_t*) / PAGE_SIZE);
+    pid_hash = table;
+    pid_hash_size = size;
+}
+
+// 给任务分配 pid 并加入散列表，没有 pid 了返回 EOF
+static pid_t task_register(task_t* task)
+{
+    // 扩展散列表可能阻塞，要在任务可以被找到之前
+    if (task_count + 1 > pid_hash_size * 2)
+        pid_hash_grow();
+
+    pid_t pid = pid_alloc();
+    if (pid == EOF)
+        return EOF;
+
+    task->pid = pid;
+    list_init(&(task->children));
+    list_init(&(task->regions));
+    task->sibling.next = NULL;
+    task->sibling.prve = NULL;
+
+    u32 idx = pid & (pid_hash_size - 1);
+    task->hash_next = pid_hash[idx];
+    pid_hash[idx] = task;
+    task_count++;
+    return pid;
+}
+
+// 从散列表中去掉任务，释放 pid
+static void task_unregister(task_t* task)
+{
+    task_t** ptr = pid_hash + (task->pid & (pid_hash_size - 1));
+    while (*ptr != task)
+        ptr = &((*ptr)->hash_next);
+    *ptr = task->hash_next;
+
+    pid_free(task->pid);
+    task_count--;
+}
+
+// 分配一个空白的任务，没有 pid 了返回 NULL
+static task_t* get_free_task()
+{
+    task_t* task = (task_t*)alloc_kpage_zero(1);
+    if (task_register(task) == EOF)
+    {
+        free_kpage((u32)task, 1);
+        return NULL;
+    }
+    return task;
 }
 
 // 获取进程 id
@@ -61,6 +189,20 @@ pid_t sys_getppid()
     return task->ppid;
 }
 
+task_t* task_next(pid_t pid)
+{
+    assert(pid >= 0);
+    for (u32 idx = pid / 32; idx < PID_MAX / 32; ++idx)
+    {
+        u32 bits = pid_map[idx];
+        if (idx == pid / 32)
+            bits &= ~((1 << (pid % 32)) - 1);
+        if (bits)
+            return task_find(idx * 32 + bit_first(bits));
+    }
+    return NULL;
+}
+
 // 获得当前进程的第一个空闲
 fd_t task_get_fd(task_t* task)
 {
@@ -83,34 +225,42 @@ void task_put_fd(task_t* task, fd_t fd)
 
 extern pid_t sys_getppid();
 
-// 从任务数组中查找到某种状态的任务，自己除外
-static task_t* task_search(task_state_t state)
+// 就绪的任务放到所在优先级队列的末尾
+static void run_queue_push(task_t* task)
 {
-    // 原子操作，保证中断被关闭
-    assert(!get_interrupt_state());
-    task_t* task = NULL;
-    task_t* current = running_task();
+    assert(task->node.next == NULL && task->node.prve == NULL);
+    list_insert_before(&(run_queue[task->priority].tail), &(task->node));
+    run_queue_map |= (1 << task->priority);
 
-    for (size_t i = 0; i < NR_TASKS; ++i)
-    {
-        task_t* ptr = task_table[i];
-        if (ptr == NULL)
-            continue;
+    // 有了新的就绪任务，时钟不能再跳过中断
+    if (task != running_task())
+        clock_kick();
+}
 
-        if (ptr->state != state)
-            continue;
-        if (current == ptr)
-            continue;
-        
-        // 找到 ticks 更大或 jiffies 更大的
-        if (task == NULL || task->ticks < ptr->ticks || ptr->jiffies < task->jiffies)
-            task = ptr;
-    }
+bool task_ready_empty()
+{
+    return !run_queue_map;
+}
 
-    // 所有任务都阻塞了！！！运行空闲进行
-    if (task == NULL && state == TASK_REDAY)
-        task = idle_task;
-    
+// 从就绪队列中去掉任务
+static void run_queue_remove(task_t* task)
+{
+    list_remove(&(task->node));
+    if (list_empty(run_queue + task->priority))
+        run_queue_map &= ~(1 << task->priority);
+}
+
+// 取出最高优先级队列的第一个任务，没有就绪的任务时运行空闲任务
+static task_t* run_queue_pop()
+{
+    // 原子操作，保证中断被关闭
+    assert(!get_interrupt_state());
+    if (!run_queue_map)
+        return idle_task;
+
+    list_t* list = run_queue + bit_last(run_queue_map);
+    task_t* task = element_entry(task_t, node, list->head.next);
+    run_queue_remove(task);
     return task;
 }
 
@@ -142,20 +292,23 @@ void schedule()
     // 不可中断
     assert(!get_interrupt_state());
     
-    // 获取当前、与下一关任务
+    // 当前任务还可以运行，放回就绪队列的末尾，空闲任务不进入队列
     task_t* current = running_task();
-    task_t* next = task_search(TASK_REDAY);
-
-    assert(next != NULL);
-    assert(next->magic == ONIX_MAGIC);
-
-    // 切换当前任务状态
     if (current->state == TASK_RUNNING)
+    {
         current->state = TASK_REDAY;
-    
+        if (current != idle_task)
+            run_queue_push(current);
+    }
+
     if (!current->ticks)
         current->ticks = current->priority; 
 
+    // 获取下一个任务
+    task_t* next = run_queue_pop();
+    assert(next != NULL);
+    assert(next->magic == ONIX_MAGIC);
+
     // 切换下一关任务状态
     next->state = TASK_RUNNING;
     if (next == current)
@@ -167,72 +320,111 @@ void schedule()
     task_switch(next);
 }
 
-void task_sleep(u32 ms)
+// 睡眠的定时器到期，唤醒任务
+static void task_sleep_timeout(timer_t* timer)
 {
-    assert(!get_interrupt_state());
+    task_t* task = (task_t*)timer->arg;
+    assert(task->state == TASK_SLEEPING);
+    task_unblock(task);
+}
 
-    // 需要睡眠的时间片：总毫秒数除以一个时间片的毫秒值
-    u32 ticks = ms / jiffy;
-    ticks = ticks > 0 ? ticks : 1;
+// 当前任务进入睡眠链表，等定时器到期时唤醒
+static void task_sleep_block(task_t* current)
+{
+    // 睡眠的任务放在睡眠链表中，唤醒时从链表中去掉
+    list_insert_before(&(sleep_list.tail), &(current->node));
+
+    // 更新任务状态
+    current->state = TASK_SLEEPING;
+
+    // 调度
+    schedule();
+}
 
-    // 记录目标全局时间片，在那个时刻需要唤醒任务
+// 睡眠 ticks 个时间片
+static void task_sleep_ticks(u32 ticks)
+{
     task_t* current = running_task();
-    // 全局时间片到达这个值后，任务被唤醒
-    current->ticks = jiffies + ticks;
+    assert(current->node.next == NULL);
+    assert(current->node.prve == NULL);
 
-    // 从睡眠链表找到第一个比当前任务唤醒时间更晚的任务，进行插入
-    list_t* list = &sleep_list;
-    list_node_t* anchor = &list->tail;
+    // 跳过时钟中断时 jiffies 可能落后，先追上再计算到期时间，否则会提前醒来
+    clock_catchup();
 
-    // 越早被唤醒的任务排在越前面 
-    for (list_node_t* ptr = list->head.next; ptr != &(list->tail); ptr = ptr->next)
-    {
-        task_t * task = element_entry(task_t, node, ptr);
+    // 定时器在栈上，任务醒来之前一直有效，全局时间片到达之后唤醒任务
+    timer_t timer;
+    timer_setup(&timer, task_sleep_timeout, current);
+    timer_add(&timer, jiffies + ticks);
 
-        if (task->ticks > current->ticks)
-        {
-            anchor = ptr;
-            break;
-        }
-    }
+    task_sleep_block(current);
+}
 
-    assert(current->node.next == NULL);
-    assert(current->node.prve == NULL);
-    
-    // 插入
-    list_insert_before(anchor, &(current->node));
+void task_sleep(u32 ms)
+{
+    assert(!get_interrupt_state());
 
-    // 更新任务状态
-    current->state = TASK_SLEEPING;
+    // 需要睡眠的时间片：总毫秒数除以一个时间片的毫秒值
+    u32 ticks = ms / jiffy;
+    ticks = ticks > 0 ? ticks : 1;
 
-    // 调度
-    schedule();
+    task_sleep_ticks(ticks);
+}
+
+// 高精度定时器到期，唤醒任务
+static void task_hrsleep_timeout(hrtimer_t* timer)
+{
+    task_t* task = (task_t*)timer->arg;
+    assert(task->state == TASK_SLEEPING);
+    task_unblock(task);
 }
 
-// 唤醒睡眠链表中的应该唤醒的任务
-void task_wakeup()
+int task_nanosleep(const timespec* req, timespec* rem)
 {
     assert(!get_interrupt_state());
+    if (req->tv_nsec >= NSEC_PER_SEC)
+        return EOF;
+
+    u64 deadline = clock_monotonic() + (u64)req->tv_sec * NSEC_PER_SEC + req->tv_nsec;
+    u32 jiffy_ns = jiffy * NSEC_PER_MSEC;
+    task_t* current = running_task();
 
-    // 从睡眠链表中找到第一个 tick 大于当前时间片的，这个以及之后都不能被唤醒
-    list_t* list = &(sleep_list);
-    for (list_node_t* ptr = list->head.next; ptr != &(list->tail);)
+    while (true)
     {
-        task_t* task = element_entry(task_t, node, ptr);
-        if (task->ticks > jiffies)
+        u64 now = clock_monotonic();
+        if (now >= deadline)
             break;
-        
-        ptr = ptr->next;
 
-        task->ticks = 0;
-        task_unblock(task);
+        // 剩余两个时间片以上时先用时间轮睡到最后一个时间片之前，
+        // 时间片的边界不精确，醒来之后重新计算剩余的时间
+        u64 ticks = div_u64(deadline - now, jiffy_ns, NULL);
+        if (ticks > 2)
+        {
+            task_sleep_ticks((u32)MIN(ticks - 1, NSLEEP_TICKS_MAX));
+            continue;
+        }
+
+        // 剩下的用高精度定时器，在到期的时刻唤醒
+        hrtimer_t timer;
+        hrtimer_setup(&timer, task_hrsleep_timeout, current);
+        hrtimer_add(&timer, deadline);
+        task_sleep_block(current);
+    }
+
+    // 没有信号打断睡眠，剩余时间总是 0
+    if (rem)
+    {
+        rem->tv_sec = 0;
+        rem->tv_nsec = 0;
     }
+    return 0;
 }
 
 // 创建任务
 static task_t* task_create(target_t target, const char* name, u32 priority, u32 uid)
 {
+    assert(priority < PRIORITY_NR);
     task_t* task = get_free_task();
+    assert(task);
 
     // 页尾做栈顶（高地址）
     u32 stack = (u32)task + PAGE_SIZE;
@@ -278,26 +470,29 @@ static task_t* task_create(target_t target, const char* name, u32 priority, u32
     task->files[STDOUT_FILENO]->count++;
     task->files[STDERR_FILENO]->count++;
 
+    run_queue_push(task);
     return task;
 }
 
 extern int sys_execve(char* filename, char* argvp[], char* envp[]);
 
-// 调用该函数的地方不能用任何局部变量
-// 调用前栈顶需要准备足够的空间
-void task_to_user_mode()
+// 用一页空间 buf 保存位图，初始化用户进程的虚拟内存位图
+static void task_vmap_init(bitmap_t* vmap, void* buf)
 {
-    task_t* task = running_task(); 
-
-    task->vmap = kmalloc(sizeof(bitmap_t));
-    // 用一页空间来保存位图
-    void* buf = (void*)alloc_kpage(1);
-    bitmap_init(task->vmap, buf, USER_MMAP_SIZE / PAGE_SIZE / 8, USER_MMAP_ADDR / PAGE_SIZE);
+    bitmap_init(vmap, buf, USER_MMAP_SIZE / PAGE_SIZE / 8, USER_MMAP_ADDR / PAGE_SIZE);
+}
 
-    // 创建用户进程页表
-    task->pde = (u32)copy_pde();
-    set_cr3(task->pde);
+// 创建用户进程的虚拟内存位图
+static bitmap_t* task_vmap_create()
+{
+    bitmap_t* vmap = kmalloc(sizeof(bitmap_t));
+    task_vmap_init(vmap, (void*)alloc_kpage(1));
+    return vmap;
+}
 
+// 在内核栈顶构造返回用户态的中断现场
+static intr_frame_t* task_user_frame(task_t* task)
+{
     u32 addr = (u32)task + PAGE_SIZE;
 
     addr -= sizeof(intr_frame_t);
@@ -325,6 +520,23 @@ void task_to_user_mode()
     iframe->eip = 0;
     iframe->eflags = (0 << 12 | 0b10 | 1 << 9); 
     iframe->esp = USER_STACK_TOP;
+    return iframe;
+}
+
+// 调用该函数的地方不能用任何局部变量
+// 调用前栈顶需要准备足够的空间
+void task_to_user_mode()
+{
+    task_t* task = running_task(); 
+
+    task->vmap = task_vmap_create();
+
+    // 创建用户进程页表，只有内核映射，copy_pde 的来源是当前进程的页目录，不能用在这里
+    task->pde = alloc_kpage(1);
+    create_pde((page_entry_t*)task->pde);
+    set_cr3(task->pde);
+
+    task_user_frame(task);
 
     int err = sys_execve("/bin/init.out", NULL, NULL);
     panic("exec /bin/init.out failure!");
@@ -338,8 +550,13 @@ static void task_setup()
     task->magic = ONIX_MAGIC;
     task->ticks = 1;
 
-    // 设置起始任务数组为空
-    memset(task_table, 0, sizeof(task_table));
+    // 散列表开始为一页
+    pid_hash_size = PID_HASH_INIT;
+    pid_hash = (task_t**)alloc_kpage(1);
+    memset(pid_hash, 0, PAGE_SIZE);
+    memset(pid_map, 0, sizeof(pid_map));
+    pid_last = -1;
+    task_count = 0;
 }
 
 void task_yield()
@@ -350,6 +567,11 @@ void task_yield()
 void task_block(task_t* task, list_t* blist, task_state_t state)
 {
     assert(!get_interrupt_state());
+
+    // 就绪的任务先从就绪队列中去掉
+    if (task->state == TASK_REDAY)
+        run_queue_remove(task);
+
     assert(task->node.next == NULL);
     assert(task->node.prve == NULL);
 
@@ -377,6 +599,7 @@ void task_unblock(task_t* task)
     assert(task->node.prve == NULL);
 
     task->state = TASK_REDAY;
+    run_queue_push(task);
 }
 
 extern void interrupt_exit();
@@ -405,42 +628,47 @@ static void task_build_stack(task_t* task)
     task->stack = (u32*)frame;
 }
 
-// fork!!
-pid_t task_fork()
+// 复制当前进程的 PCB 作为子进程，files 为子进程的文件表
+// space 为真时子进程有自己的地址空间，分配好虚拟内存位图与页目录的内核页，内容由调用者填写
+// 内核页或者 pid 不够时返回 NULL，这时没有修改任何状态
+static task_t* task_copy(task_t* task, file_t** files, bool space)
 {
-    task_t* task = running_task();
-
-    // 当前进程非阻塞，并且正在执行
-    assert(task->node.next == NULL && task->node.prve == NULL && task->state == TASK_RUNNING);
+    // 先分配所有需要的内核页，失败时只需要释放它们
+    task_t* child = (task_t*)try_alloc_kpage(1);
+    char* pwd = (char*)try_alloc_kpage(1);
+    void* bits = NULL;
+    u32 pde = 0;
+    if (space)
+    {
+        bits = (void*)try_alloc_kpage(1);
+        pde = try_alloc_kpage(1);
+    }
+    if (!child || !pwd || (space && (!bits || !pde)))
+        goto rollback;
 
-    // 拷贝内核 和 PCB
-    task_t* child = get_free_task();
-    pid_t pid = child->pid;
-    // 父、子进程整页复制
+    // 父、子进程整页复制，之后再分配 pid
     memcpy(child, task, PAGE_SIZE);
+    if (task_register(child) == EOF)
+        goto rollback;
 
-    // 改变子进程的若干字段
-    child->pid = pid;
+    // 改变子进程的若干字段，加入父进程的子进程链表
     child->ppid = task->pid;
+    list_insert_before(&(task->children.tail), &(child->sibling));
     child->ticks = child->priority;
     child->state = TASK_REDAY;
-
-    // 拷贝用户进程虚拟内存位图
-    child->vmap = kmalloc(sizeof(bitmap_t));
-    memcpy(child->vmap, task->vmap, sizeof(bitmap_t));
-
-    // 拷贝虚拟内存位图缓存
-    void* buf = (void*)alloc_kpage(1);
-    memcpy(buf, task->vmap->bits, PAGE_SIZE);
-    child->vmap->bits = buf;
-
-    // 拷贝页目录
-    child->pde = (u32)copy_pde();
+    child->vfork = false;
 
     // 拷贝 pwd
-    child->pwd = (char*)alloc_kpage(1);
+    child->pwd = pwd;
     strncpy(child->pwd, task->pwd, PAGE_SIZE);
 
+    if (space)
+    {
+        child->vmap = kmalloc(sizeof(bitmap_t));
+        child->vmap->bits = bits;
+        child->pde = pde;
+    }
+
     task->ipwd->count++;
     task->iroot->count++;
     if (task->iexec)
@@ -449,11 +677,49 @@ pid_t task_fork()
     // 文件引用加 1
     for (size_t i = 0; i < TASK_FILE_NR; ++i)
     {
-        file_t* file = child->files[i];
+        file_t* file = files[i];
+        child->files[i] = file;
         if (file)
             file->count++;
     }
 
+    run_queue_push(child);
+    return child;
+
+rollback:
+    if (child)
+        free_kpage((u32)child, 1);
+    if (pwd)
+        free_kpage((u32)pwd, 1);
+    if (bits)
+        free_kpage((u32)bits, 1);
+    if (pde)
+        free_kpage(pde, 1);
+    return NULL;
+}
+
+// fork!!
+pid_t task_fork()
+{
+    task_t* task = running_task();
+
+    // 当前进程非阻塞，并且正在执行
+    assert(task->node.next == NULL && task->node.prve == NULL && task->state == TASK_RUNNING);
+
+    task_t* child = task_copy(task, task->files, true);
+    if (!child)
+        return EOF;
+    region_fork(task, child);
+
+    // 拷贝用户进程虚拟内存位图与位图缓存
+    void* buf = child->vmap->bits;
+    memcpy(child->vmap, task->vmap, sizeof(bitmap_t));
+    memcpy(buf, task->vmap->bits, PAGE_SIZE);
+    child->vmap->bits = buf;
+
+    // 拷贝页目录
+    copy_pde((page_entry_t*)child->pde);
+
     // 构造 child 内核栈
     task_build_stack(child);
 
@@ -461,6 +727,137 @@ pid_t task_fork()
     return child->pid;
 }
 
+// vfork 的子进程不再借用父进程的地址空间，唤醒父进程
+static void task_vfork_done(task_t* task)
+{
+    assert(task->vfork);
+    task->vfork = false;
+
+    task_t* parent = task_find(task->ppid);
+    assert(parent->state == TASK_BLOCKED);
+    task_unblock(parent);
+}
+
+// vfork!! 子进程借用父进程的地址空间，父进程阻塞到子进程 execve 或退出
+pid_t task_vfork()
+{
+    task_t* task = running_task();
+
+    // 当前进程非阻塞，并且正在执行
+    assert(task->node.next == NULL && task->node.prve == NULL && task->state == TASK_RUNNING);
+
+    task_t* child = task_copy(task, task->files, false);
+    if (!child)
+        return EOF;
+    region_fork(task, child);
+    pid_t pid = child->pid;
+
+    // 页目录与虚拟内存位图都直接使用父进程的
+    child->vfork = true;
+
+    // 构造 child 内核栈
+    task_build_stack(child);
+
+    // 父进程阻塞，子进程先执行
+    task_block(task, NULL, TASK_BLOCKED);
+
+    // 父进程返回子进程 pid
+    return pid;
+}
+
+// vfork 的子进程 execve 时创建自己的地址空间
+// 内核页不够时返回 EOF，子进程仍然借用父进程的地址空间
+int task_vfork_exec(task_t* task)
+{
+    void* bits = (void*)try_alloc_kpage(1);
+    u32 pde = try_alloc_kpage(1);
+    if (!bits || !pde)
+    {
+        if (bits)
+            free_kpage((u32)bits, 1);
+        if (pde)
+            free_kpage(pde, 1);
+        return EOF;
+    }
+
+    task->vmap = kmalloc(sizeof(bitmap_t));
+    task_vmap_init(task->vmap, bits);
+    task->pde = pde;
+    create_pde((page_entry_t*)task->pde);
+    set_cr3(task->pde);
+
+    task->brk = USER_EXEC_ADDR;
+    task->text = USER_EXEC_ADDR;
+    task->data = USER_EXEC_ADDR;
+    task->end = USER_EXEC_ADDR;
+
+    task_vfork_done(task);
+    return 0;
+}
+
+// 创建子进程，不复制父进程的地址空间，子进程在内核中从 entry(arg) 开始执行
+// actions 为子进程开始执行之前对文件描述符的操作
+pid_t task_spawn(char* name, target_t entry, void* arg, spawn_action_t* actions)
+{
+    task_t* task = running_task();
+
+    // 先在文件表的副本上执行操作，出错时不需要回滚
+    file_t* files[TASK_FILE_NR];
+    memcpy(files, task->files, sizeof(files));
+
+    for (spawn_action_t* action = actions; action && action->type != SPAWN_END; action++)
+    {
+        if (action->fd < 0 || action->fd >= TASK_FILE_NR || !files[action->fd])
+            return EOF;
+
+        if (action->type == SPAWN_DUP2)
+        {
+            if (action->newfd < 0 || action->newfd >= TASK_FILE_NR)
+                return EOF;
+            files[action->newfd] = files[action->fd];
+        }
+        else if (action->type == SPAWN_CLOSE)
+        {
+            files[action->fd] = NULL;
+        }
+        else
+        {
+            return EOF;
+        }
+    }
+
+    task_t* child = task_copy(task, files, true);
+    if (!child)
+        return EOF;
+    strncpy(child->name, name, TASK_NAME_LEN);
+
+    // 全新的地址空间，不继承文件映射区域
+    list_init(&(child->regions));
+    task_vmap_init(child->vmap, child->vmap->bits);
+    create_pde((page_entry_t*)child->pde);
+    child->brk = USER_EXEC_ADDR;
+    child->text = USER_EXEC_ADDR;
+    child->data = USER_EXEC_ADDR;
+    child->end = USER_EXEC_ADDR;
+
+    // 栈顶是返回用户态的中断现场，之下是 entry 的参数与返回地址
+    u32* stack = (u32*)task_user_frame(child);
+    *(--stack) = (u32)arg;
+    // entry 不会返回
+    *(--stack) = 0;
+
+    // 构造任务切换现场，切换后从 entry 开始执行
+    task_frame_t* frame = (task_frame_t*)stack - 1;
+    frame->ebp = 0xaa55aa55;
+    frame->ebx = 0xaa55aa55;
+    frame->edi = 0xaa55aa55;
+    frame->esi = 0xaa55aa55;
+    frame->eip = entry;
+
+    child->stack = (u32*)frame;
+    return child->pid;
+}
+
 void task_exit(int status)
 {
     task_t* task = running_task();
@@ -472,12 +869,23 @@ void task_exit(int status)
     task->state = TASK_DIED;
     task->status = status;
 
-    // 释放页目录
-    free_pde();
+    // 共享文件映射的脏页要在释放页目录之前写回
+    region_clear(task);
+
+    if (task->vfork)
+    {
+        // 地址空间是借用父进程的，还回去即可
+        task_vfork_done(task);
+    }
+    else
+    {
+        // 释放页目录
+        free_pde();
 
-    // 释放虚拟位图
-    free_kpage((u32)task->vmap->bits, 1);
-    kfree(task->vmap);
+        // 释放虚拟位图
+        free_kpage((u32)task->vmap->bits, 1);
+        kfree(task->vmap);
+    }
 
     // 释放文件
     free_kpage((u32)task->pwd, 1);
@@ -495,21 +903,18 @@ void task_exit(int status)
         }
     }
 
-    // 将子进程的父进程复制为自己的父进程
-    for (size_t i = 0; i < NR_TASKS; ++i)
+    // 子进程交给自己的父进程
+    task_t* parent = task_find(task->ppid);
+    assert(parent);
+    while (!list_empty(&(task->children)))
     {
-        task_t* child = task_table[i];
-        if (!child)
-            continue;
-        
-        if (child->ppid != task->pid)
-            continue;
-
-        child->ppid = task->ppid;
+        list_node_t* node = list_pop(&(task->children));
+        task_t* child = element_entry(task_t, sibling, node);
+        child->ppid = parent->pid;
+        list_insert_before(&(parent->children.tail), node);
     }
     LOGK("task 0x%p exit...\n", task);
 
-    task_t* parent = task_table[task->ppid];
     // 如果：父进程在等待状态，并且（父进程在等待所有的子进程或父进程在等待这个子进程死亡）
     if (parent->state == TASK_WAITING && 
         (parent->waitpid == -1 || parent->waitpid == task->pid))
@@ -521,45 +926,54 @@ void task_exit(int status)
     schedule();
 }
 
+// 回收已经死亡的子进程，返回它的 pid
+static pid_t task_reap(task_t* child, int32* status)
+{
+    assert(child->state == TASK_DIED);
+    list_remove(&(child->sibling));
+    task_unregister(child);
+
+    *status = child->status;
+    pid_t ret = child->pid;
+
+    free_kpage((u32)child, 1);
+    return ret;
+}
+
 pid_t task_waitpid(pid_t pid, int32* status)
 {
     task_t* task = running_task();
-    task_t* child = NULL;
 
     while (true)
     {
         bool has_child = false;
-        for (size_t i = 2; i < NR_TASKS; ++i)
+
+        if (pid != -1)
+        {
+            // 等待指定的子进程，直接通过 pid 查找
+            task_t* ptr = task_find(pid);
+            if (ptr && ptr->ppid == task->pid && ptr->sibling.next)
+            {
+                if (ptr->state == TASK_DIED)
+                    return task_reap(ptr, status);
+                has_child = true;
+            }
+        }
+        else
         {
-            task_t* ptr = task_table[i];
-            // 空任务
-            if (!ptr)
-                continue;
-
-            // 不是子进程
-            if (ptr->ppid != task->pid)
-                continue;
-
-            // 不是等待的子进程
-            if (pid != ptr->pid && pid != -1)
-                continue;
-            
-            // 满足条件，找到了 pid 的子进程
-            // 当前，子进程已经死亡，可以直接回收，跳转即可
-            if (ptr->state == TASK_DIED)
+            // 等待任意一个子进程，只查找自己的子进程链表
+            list_t* list = &(task->children);
+            for (list_node_t* node = list->head.next; node != &(list->tail); node = node->next)
             {
-                child = ptr;
-                task_table[i] = NULL;
+                task_t* ptr = element_entry(task_t, sibling, node);
 
-                *status = child->status;
-                u32 ret = child->pid;
+                // 子进程已经死亡，可以直接回收
+                if (ptr->state == TASK_DIED)
+                    return task_reap(ptr, status);
 
-                free_kpage((u32)child, 1);
-                return ret;
+                // 有子进程，但还没有死亡，需要等待这个子进程到死亡为止
+                has_child = true;
             }
-
-            // 有目标子进程，但还没有死亡，需要等待这个子进程到死亡为止
-            has_child = true;
         }
 
         if (has_child)
@@ -588,10 +1002,14 @@ void task_init()
 {
     list_init(&block_list);
     list_init(&sleep_list);
+    for (size_t i = 0; i < PRIORITY_NR; i++)
+        list_init(run_queue + i);
 
     task_setup();
 
     idle_task = task_create(idle_thread, "idle", 1, KERNEL_USER);
+    // 空闲任务不在就绪队列中，没有其他就绪的任务时才运行
+    run_queue_remove(idle_task);
     task_create(init_thread, "init", 5, NORMAL_USER);
     task_create(test_thread, "test", 5, KERNEL_USER);
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <onix/mutex.h>
 #include <onix/arena.h>
 #include <onix/types.h>
+#include <onix/memory.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -18,10 +19,14 @@ void idle_thread()
     while (true)
     {
         // LOGK("idle task... %d\n", counter++);
-        asm volatile(
-            "sti\n"
-            "hlt\n"
-        );
+        // 还有空闲页需要清零时不停机，每次只清零一页，尽快让出处理器
+        if (!zero_pool_fill())
+        {
+            asm volatile(
+                "sti\n"
+                "hlt\n"
+            );
+        }
         yield();
     }
 }
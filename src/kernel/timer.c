@@ -0,0 +1,265 @@
+#include <onix/timer.h>
+#include <onix/interrupt.h>
+#include <onix/assert.h>
+#include <onix/debug.h>
+#include <ds/list.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+// 分层时间轮，第一层 256 个槽，每个槽一个时间片
+// 之后四层各 64 个槽，每个槽覆盖上一层一圈的时间，一共覆盖 32 位的时间片
+// 加入与取消都是 O(1)，上层的定时器在下层转完一圈时才分散到下层
+#define ROOT_BITS 8
+#define LEVEL_BITS 6
+#define ROOT_SIZE (1 << ROOT_BITS)
+#define LEVEL_SIZE (1 << LEVEL_BITS)
+#define ROOT_MASK (ROOT_SIZE - 1)
+#define LEVEL_MASK (LEVEL_SIZE - 1)
+#define LEVEL_NR 4
+
+// 第 n 层（从 0 开始，不包括第一层）time 对应的槽
+#define LEVEL_INDEX(time, n) (((time) >> (ROOT_BITS + (n) * LEVEL_BITS)) & LEVEL_MASK)
+
+extern u32 volatile jiffies;
+extern void clock_kick();
+extern void clock_hrtimer_kick();
+
+static list_t root[ROOT_SIZE];
+static list_t levels[LEVEL_NR][LEVEL_SIZE];
+
+// 高精度定时器，按到期时间从早到晚排列
+static list_t hrtimer_list;
+
+// 时间轮处理到的时间片，小于它的定时器都已经到期
+static u32 timer_jiffies;
+
+// 把定时器放入到期时间对应的槽
+static void timer_insert(timer_t* timer)
+{
+    u32 expires = timer->expires;
+    u32 delta = expires - timer_jiffies;
+    list_t* list = NULL;
+
+    if ((int)delta < 0)
+    {
+        // 已经过期，下一个时间片处理
+        list = root + (timer_jiffies & ROOT_MASK);
+    }
+    else if (delta < ROOT_SIZE)
+    {
+        list = root + (expires & ROOT_MASK);
+    }
+    else
+    {
+        u32 level = 0;
+        while (level < LEVEL_NR - 1 && delta >= (1 << (ROOT_BITS + (level + 1) * LEVEL_BITS)))
+            level++;
+        list = levels[level] + LEVEL_INDEX(expires, level);
+    }
+
+    list_insert_before(&(list->tail), &(timer->node));
+}
+
+// 把 from 中的节点全部移动到 to 中
+static void list_move(list_t* from, list_t* to)
+{
+    list_init(to);
+    if (list_empty(from))
+        return;
+
+    list_node_t* first = from->head.next;
+    list_node_t* last = from->tail.prve;
+
+    to->head.next = first;
+    first->prve = &(to->head);
+    to->tail.prve = last;
+    last->next = &(to->tail);
+
+    list_init(from);
+}
+
+// 把第 level 层 index 槽的定时器重新放入下层，返回 index
+static u32 timer_cascade(u32 level, u32 index)
+{
+    list_t list;
+    list_move(levels[level] + index, &list);
+
+    while (!list_empty(&list))
+    {
+        timer_t* timer = element_entry(timer_t, node, list_pop(&list));
+        timer_insert(timer);
+    }
+    return index;
+}
+
+void timer_setup(timer_t* timer, timer_handler_t handler, void* arg)
+{
+    timer->node.next = NULL;
+    timer->node.prve = NULL;
+    timer->expires = 0;
+    timer->handler = handler;
+    timer->arg = arg;
+}
+
+bool timer_pending(timer_t* timer)
+{
+    return timer->node.next != NULL;
+}
+
+void timer_add(timer_t* timer, u32 expires)
+{
+    assert(!get_interrupt_state());
+    assert(!timer_pending(timer));
+
+    timer->expires = expires;
+    timer_insert(timer);
+
+    // 时钟可能正在跳过中断，重新计算下一次中断的时间
+    clock_kick();
+}
+
+bool timer_del(timer_t* timer)
+{
+    assert(!get_interrupt_state());
+    if (!timer_pending(timer))
+        return false;
+
+    list_remove(&(timer->node));
+    return true;
+}
+
+void timer_mod(timer_t* timer, u32 expires)
+{
+    timer_del(timer);
+    timer_add(timer, expires);
+}
+
+// 从现在开始，到需要处理定时器的时间片为止的时间片数量，最多 max 个
+// 第一层转完一圈时要把上层的定时器分散下来，也要处理
+u32 timer_next_ticks(u32 max)
+{
+    for (u32 i = 0; i < max; i++)
+    {
+        u32 index = (timer_jiffies + i) & ROOT_MASK;
+        if (!index || !list_empty(root + index))
+            return i + 1;
+    }
+    return max;
+}
+
+// 时钟中断中调用，处理到当前时间片为止到期的定时器
+void timer_wakeup()
+{
+    assert(!get_interrupt_state());
+
+    while ((int)(jiffies - timer_jiffies) >= 0)
+    {
+        u32 index = timer_jiffies & ROOT_MASK;
+
+        // 第一层转完一圈，上层的一个槽分散到下层，一层转完一圈再处理更上一层
+        if (!index)
+        {
+            for (u32 level = 0; level < LEVEL_NR; level++)
+            {
+                if (timer_cascade(level, LEVEL_INDEX(timer_jiffies, level)))
+                    break;
+            }
+        }
+
+        // 先前进，处理函数中加入的已到期定时器在下一个时间片处理
+        timer_jiffies++;
+
+        list_t list;
+        list_move(root + index, &list);
+        while (!list_empty(&list))
+        {
+            timer_t* timer = element_entry(timer_t, node, list_pop(&list));
+            timer->handler(timer);
+        }
+    }
+}
+
+void hrtimer_setup(hrtimer_t* timer, hrtimer_handler_t handler, void* arg)
+{
+    timer->node.next = NULL;
+    timer->node.prve = NULL;
+    timer->expires = 0;
+    timer->handler = handler;
+    timer->arg = arg;
+}
+
+void hrtimer_add(hrtimer_t* timer, u64 expires)
+{
+    assert(!get_interrupt_state());
+    assert(timer->node.next == NULL);
+
+    timer->expires = expires;
+
+    // 从后向前找到第一个不晚于它的定时器，同时到期的按加入顺序处理
+    list_node_t* node = hrtimer_list.tail.prve;
+    for (; node != &hrtimer_list.head; node = node->prve)
+    {
+        hrtimer_t* prev = element_entry(hrtimer_t, node, node);
+        if (prev->expires <= expires)
+            break;
+    }
+    list_insert_after(node, &(timer->node));
+
+    // 成为最早到期的定时器，可能需要提前下一次时钟中断
+    if (node == &hrtimer_list.head)
+        clock_hrtimer_kick();
+}
+
+bool hrtimer_del(hrtimer_t* timer)
+{
+    assert(!get_interrupt_state());
+    if (timer->node.next == NULL)
+        return false;
+
+    list_remove(&(timer->node));
+    return true;
+}
+
+// 最早到期的高精度定时器的到期时间，没有定时器返回 false
+bool hrtimer_next(u64* expires)
+{
+    if (list_empty(&hrtimer_list))
+        return false;
+
+    hrtimer_t* timer = element_entry(hrtimer_t, node, hrtimer_list.head.next);
+    *expires = timer->expires;
+    return true;
+}
+
+// 时钟中断中调用，处理单调时间 now 之前到期的高精度定时器
+void hrtimer_wakeup(u64 now)
+{
+    assert(!get_interrupt_state());
+
+    while (!list_empty(&hrtimer_list))
+    {
+        hrtimer_t* timer = element_entry(hrtimer_t, node, hrtimer_list.head.next);
+        if (timer->expires > now)
+            break;
+
+        list_remove(&(timer->node));
+        timer->handler(timer);
+    }
+}
+
+void timer_init()
+{
+    LOGK("timer init...\n");
+
+    for (size_t i = 0; i < ROOT_SIZE; i++)
+        list_init(root + i);
+
+    for (size_t i = 0; i < LEVEL_NR; i++)
+    {
+        for (size_t j = 0; j < LEVEL_SIZE; j++)
+            list_init(levels[i] + j);
+    }
+    timer_jiffies = jiffies;
+
+    list_init(&hrtimer_list);
+}
@@ -0,0 +1,410 @@
+#include <onix/zram.h>
+#include <onix/lz.h>
+#include <onix/memory.h>
+#include <onix/device.h>
+#include <onix/buffer.h>
+#include <onix/mutex.h>
+#include <onix/slab.h>
+#include <onix/debug.h>
+#include <onix/assert.h>
+#include <onix/io.h>
+#include <ds/list.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+// 压缩内存盘的大小等于物理内存，压缩之后实际使用的内存少得多
+// minix 文件系统的块号只有 16 位，最大 64M
+#define ZRAM_SIZE_MIN 0x400000
+#define ZRAM_SIZE_MAX 0x4000000
+
+// 压缩数据最多使用物理内存的 1 / ZRAM_MEMORY_RATIO，压缩数据的内存不能回收
+#define ZRAM_MEMORY_RATIO 4
+
+// 压缩数据按大小分级保存，每一级的对象大小是 ZRAM_CLASS_SIZE 的倍数
+#define ZRAM_CLASS_SIZE 32
+#define ZRAM_CLASS_NR (BLOCK_SIZE / ZRAM_CLASS_SIZE)
+
+// 一页中最多的对象数量
+#define ZPAGE_SLOTS_MAX (PAGE_SIZE / ZRAM_CLASS_SIZE)
+
+// 第 class 级对象的大小
+#define CLASS_SIZE(class) (((class) + 1) * ZRAM_CLASS_SIZE)
+
+// 保存同一级压缩数据的物理页，页面被分成大小相同的对象
+typedef struct zpage_t
+{
+    u32 paddr;                      // 物理页，通过 kmap 访问
+    u16 class;                      // 对象的分级
+    u16 used;                       // 使用的对象数量
+    u32 map[ZPAGE_SLOTS_MAX / 32];  // 对象占用位图
+    list_node_t node;               // 有空闲对象的页链表节点，满的页不在链表中
+} zpage_t;
+
+// 每一块的保存位置，size 为 0 表示同值块，未写过的块是值为 0 的同值块
+typedef struct zram_block_t
+{
+    union
+    {
+        zpage_t* page;  // 压缩数据所在的页
+        u32 value;      // 同值块重复的 4 字节
+    };
+    u16 size;           // 压缩后的大小，BLOCK_SIZE 表示原样保存
+    u16 slot;           // 页中的对象序号
+} zram_block_t;
+
+typedef struct zram_t
+{
+    zram_block_t* blocks;           // 块表
+    list_t partial[ZRAM_CLASS_NR];  // 每一级有空闲对象的页
+    lock_t lock;                    // 分配页面可能阻塞，读写互斥
+    zram_stat_t stat;               // 统计信息
+} zram_t;
+
+static zram_t zram;
+
+// zpage_t 从缓存中分配
+static kmem_cache_t* zpage_cache;
+
+// 只在持有锁时使用，用户的缓冲区不在 kmap 期间访问
+static u8 zram_plain[BLOCK_SIZE];   // 解压或待压缩的数据
+static u8 zram_packed[BLOCK_SIZE];  // 压缩后的数据
+
+// 分配一个 class 级的对象，返回所在的页与序号，需要新页而超过内存限制时返回 NULL
+static zpage_t* zpage_alloc(u32 class, u16* slot)
+{
+    list_t* list = zram.partial + class;
+    zpage_t* page = NULL;
+
+    if (list_empty(list))
+    {
+        if (zram.stat.pages >= zram.stat.mem_limit)
+            return NULL;
+
+        page = kmem_cache_alloc(zpage_cache);
+        memset(page, 0, sizeof(zpage_t));
+        page->paddr = alloc_page();
+        page->class = class;
+        list_insert_after(&(list->head), &(page->node));
+        zram.stat.pages++;
+    }
+    else
+    {
+        page = element_entry(zpage_t, node, list->head.next);
+    }
+
+    u32 slots = PAGE_SIZE / CLASS_SIZE(class);
+    for (u32 i = 0; i < slots; i++)
+    {
+        if (page->map[i / 32] & (1 << (i % 32)))
+            continue;
+
+        page->map[i / 32] |= (1 << (i % 32));
+        page->used++;
+
+        // 页满了，从链表中去掉
+        if (page->used == slots)
+            list_remove(&(page->node));
+
+        *slot = i;
+        return page;
+    }
+    panic("zram page map broken!!!");
+}
+
+// 释放一个对象，页空了就释放页面
+static void zpage_free(zpage_t* page, u16 slot)
+{
+    u32 slots = PAGE_SIZE / CLASS_SIZE(page->class);
+    assert(page->map[slot / 32] & (1 << (slot % 32)));
+
+    // 原来满的页重新有了空闲对象
+    if (page->used == slots)
+        list_insert_after(&(zram.partial[page->class].head), &(page->node));
+
+    page->map[slot / 32] &= ~(1 << (slot % 32));
+    page->used--;
+    if (page->used)
+        return;
+
+    list_remove(&(page->node));
+    free_page(page->paddr);
+    kmem_cache_free(zpage_cache, page);
+    zram.stat.pages--;
+}
+
+// 释放第 idx 块保存的数据，之后这一块读为 0
+static void zram_free(idx_t idx)
+{
+    zram_block_t* block = zram.blocks + idx;
+    if (!block->size)
+    {
+        if (block->value)
+            zram.stat.same_blocks--;
+    }
+    else
+    {
+        if (block->size == BLOCK_SIZE)
+            zram.stat.huge_blocks--;
+        zram.stat.orig_size -= BLOCK_SIZE;
+        zram.stat.compr_size -= block->size;
+        zpage_free(block->page, block->slot);
+    }
+    memset(block, 0, sizeof(zram_block_t));
+}
+
+// 整块的每 4 个字节都相同，返回 true，value 为这 4 个字节
+static bool zram_same(u32* data, u32* value)
+{
+    for (size_t i = 1; i < BLOCK_SIZE / 4; i++)
+    {
+        if (data[i] != data[0])
+            return false;
+    }
+    *value = data[0];
+    return true;
+}
+
+// 把 zram_plain 中的数据保存为第 idx 块，超过内存限制时返回 EOF，原来的数据不变
+static int zram_store(idx_t idx)
+{
+    zram_block_t* block = zram.blocks + idx;
+
+    u32 value;
+    if (zram_same((u32*)zram_plain, &value))
+    {
+        // 全 0 的块与没有写过的块一样，不计入同值块
+        zram_free(idx);
+        block->value = value;
+        if (value)
+            zram.stat.same_blocks++;
+        return 0;
+    }
+
+    u8* data = zram_packed;
+    int size = lz_compress(zram_plain, BLOCK_SIZE, zram_packed, BLOCK_SIZE - ZRAM_CLASS_SIZE);
+
+    // 压缩之后省不了空间，原样保存
+    if (size == EOF)
+    {
+        data = zram_plain;
+        size = BLOCK_SIZE;
+    }
+
+    // 先分配新的对象再释放原来的，失败时原来的数据还在
+    u32 class = div_round_up(size, ZRAM_CLASS_SIZE) - 1;
+    u16 slot;
+    zpage_t* zpage = zpage_alloc(class, &slot);
+    if (!zpage)
+        return EOF;
+
+    zram_free(idx);
+    if (size == BLOCK_SIZE)
+        zram.stat.huge_blocks++;
+    block->page = zpage;
+    block->slot = slot;
+    block->size = size;
+
+    u8* page = kmap(block->page->paddr);
+    memcpy(page + block->slot * CLASS_SIZE(class), data, size);
+    kunmap(page);
+
+    zram.stat.orig_size += BLOCK_SIZE;
+    zram.stat.compr_size += size;
+    return 0;
+}
+
+// 读取第 idx 块到 zram_plain
+static void zram_load(idx_t idx)
+{
+    zram_block_t* block = zram.blocks + idx;
+
+    if (!block->size)
+    {
+        u32* data = (u32*)zram_plain;
+        for (size_t i = 0; i < BLOCK_SIZE / 4; i++)
+            data[i] = block->value;
+        return;
+    }
+
+    u8* page = kmap(block->page->paddr);
+    u8* data = page + block->slot * CLASS_SIZE(block->page->class);
+    int size = BLOCK_SIZE;
+    if (block->size == BLOCK_SIZE)
+        memcpy(zram_plain, data, BLOCK_SIZE);
+    else
+        size = lz_decompress(data, block->size, zram_plain, BLOCK_SIZE);
+    kunmap(page);
+
+    assert(size == BLOCK_SIZE);
+}
+
+// 丢弃 [lba, lba + count) 扇区，整块释放保存的数据，不满一块的部分清零
+static int zram_discard(zram_t* disk, idx_t lba, u32 count)
+{
+    if (lba + count > disk->stat.blocks * BLOCK_SECS || lba + count < lba)
+        return EOF;
+
+    int ret = 0;
+    lock_acquire(&disk->lock);
+    while (count)
+    {
+        idx_t idx = lba / BLOCK_SECS;
+        u32 offset = (lba % BLOCK_SECS) * SECTOR_SIZE;
+        u32 sectors = MIN(count, BLOCK_SECS - lba % BLOCK_SECS);
+
+        if (sectors == BLOCK_SECS)
+        {
+            zram_free(idx);
+        }
+        else
+        {
+            zram_load(idx);
+            memset(zram_plain + offset, 0, sectors * SECTOR_SIZE);
+            if (zram_store(idx) < 0)
+            {
+                ret = EOF;
+                break;
+            }
+        }
+
+        lba += sectors;
+        count -= sectors;
+    }
+    lock_release(&disk->lock);
+    return ret;
+}
+
+int zram_ioctl(zram_t* disk, int cmd, void* args, int flags)
+{
+    switch (cmd)
+    {
+    case DEV_CMD_SECTOR_START:
+        return 0;
+    case DEV_CMD_SECTOR_COUNT:
+        return disk->stat.blocks * BLOCK_SECS;
+    case DEV_CMD_ZRAM_STAT:
+        if (!args)
+            return EOF;
+        memcpy(args, &disk->stat, sizeof(zram_stat_t));
+        return 0;
+    case DEV_CMD_DISCARD:
+    {
+        if (!args)
+            return EOF;
+        dev_range_t* range = (dev_range_t*)args;
+        return zram_discard(disk, range->start, range->count);
+    }
+    default:
+        return EOF;
+    }
+}
+
+// 以扇区为单位，在 buf 与以 lba 起始的 count 个扇区之间拷贝
+// 整块直接压缩或解压，半块先读出整块再修改，超过内存限制时写失败返回 EOF
+static int zram_copy(zram_t* disk, u8* buf, u8 count, idx_t lba, bool write)
+{
+    if (lba + count > disk->stat.blocks * BLOCK_SECS)
+        return EOF;
+    lock_acquire(&disk->lock);
+
+    int ret = 0;
+    u64 start = rdtsc();
+    u32 bytes = count * SECTOR_SIZE;
+
+    while (count)
+    {
+        idx_t idx = lba / BLOCK_SECS;
+        u32 offset = (lba % BLOCK_SECS) * SECTOR_SIZE;
+        u32 sectors = MIN(count, BLOCK_SECS - lba % BLOCK_SECS);
+        u32 len = sectors * SECTOR_SIZE;
+
+        if (write)
+        {
+            if (len < BLOCK_SIZE)
+                zram_load(idx);
+            memcpy(zram_plain + offset, buf, len);
+            if (zram_store(idx) < 0)
+            {
+                disk->stat.failed_writes++;
+                ret = EOF;
+                break;
+            }
+        }
+        else
+        {
+            zram_load(idx);
+            memcpy(buf, zram_plain + offset, len);
+        }
+
+        buf += len;
+        lba += sectors;
+        count -= sectors;
+    }
+
+    u64 cycles = rdtsc() - start;
+    if (write)
+    {
+        disk->stat.write_bytes += bytes;
+        disk->stat.write_cycles += cycles;
+    }
+    else
+    {
+        disk->stat.read_bytes += bytes;
+        disk->stat.read_cycles += cycles;
+    }
+    lock_release(&disk->lock);
+    return ret;
+}
+
+int zram_read(zram_t* disk, void* buf, u8 count, idx_t lba)
+{
+    if (zram_copy(disk, buf, count, lba, false) < 0)
+        return EOF;
+    return count;
+}
+
+int zram_write(zram_t* disk, void* buf, u8 count, idx_t lba)
+{
+    if (zram_copy(disk, buf, count, lba, true) < 0)
+        return EOF;
+    return count;
+}
+
+// 输出压缩内存盘的统计信息
+void zram_info()
+{
+    zram_stat_t* stat = &zram.stat;
+    LOGK("zram blocks %d same %d huge %d orig %d compr %d pages %d limit %d failed %d\n",
+         stat->blocks, stat->same_blocks, stat->huge_blocks,
+         stat->orig_size, stat->compr_size, stat->pages,
+         stat->mem_limit, stat->failed_writes);
+}
+
+void zram_init()
+{
+    LOGK("zram init...\n");
+
+    u32 size = memory_total_pages() * PAGE_SIZE;
+    size = MAX(size, ZRAM_SIZE_MIN);
+    size = MIN(size, ZRAM_SIZE_MAX);
+
+    zram.stat.blocks = size / BLOCK_SIZE;
+    zram.stat.mem_limit = memory_total_pages() / ZRAM_MEMORY_RATIO;
+
+    // 块表全部为 0，所有的块都读为 0
+    u32 pages = div_round_up(zram.stat.blocks * sizeof(zram_block_t), PAGE_SIZE);
+    zram.blocks = (zram_block_t*)alloc_kpage(pages);
+    memset(zram.blocks, 0, pages * PAGE_SIZE);
+
+    for (size_t i = 0; i < ZRAM_CLASS_NR; i++)
+        list_init(zram.partial + i);
+    lock_init(&zram.lock);
+
+    zpage_cache = kmem_cache_create("zpage", sizeof(zpage_t), NULL);
+
+    device_install(DEV_BLOCK, DEV_ZRAM, &zram, "zram0", 0,
+                   zram_ioctl, zram_read, zram_write);
+    LOGK("zram size 0x%p memory limit %d pages\n", size, zram.stat.mem_limit);
+}
@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <onix/types.h>
+#include <onix/syscall.h>
+#include <onix/memory.h>
+#include <onix/assert.h>
+#include <ds/bitmap.h>
+#include <string.h>
+
+// 用户态的堆内存分配
+// 小块按大小分到不同的空闲链表，大块直接 mmap，堆通过 brk 整块增长
+// 每一块前面有 8 字节的头，空闲块的大小同时记录在下一块的头中，释放时与相邻的空闲块合并
+
+// 堆中的一块，大小包括头部，是 8 的倍数，低位是标记
+typedef struct chunk_t
+{
+    u32 prev_size;          // 前一块空闲时，为前一块的大小
+    u32 size;               // 这一块的大小与标记
+    struct chunk_t* next;   // 空闲时为链表的后一块，使用时是数据
+    struct chunk_t* prev;   // 空闲时为链表的前一块
+} chunk_t;
+
+#define CHUNK_USED 1        // 这一块在使用
+#define CHUNK_PREV_USED 2   // 前一块在使用，prev_size 无效
+#define CHUNK_MMAP 4        // 这一块通过 mmap 分配
+#define CHUNK_FLAGS 7
+
+#define CHUNK_HEAD 8        // 头部的大小，数据在头部之后
+#define CHUNK_MIN 16        // 最小的块，空闲时要放下链表指针
+
+// 小于 SMALL_MAX 的块每 8 字节一个链表，大小完全相同
+// 更大的块按 2 的幂分组，组内按大小排序
+#define SMALL_MAX 1024
+#define SMALL_BINS (SMALL_MAX / 8)
+#define BIN_NR (SMALL_BINS + 32 - 10)
+
+// 大于等于 MMAP_THRESHOLD 的块直接 mmap
+#define MMAP_THRESHOLD 0x20000
+
+// 堆每次至少增长 HEAP_GROW，顶部空闲超过 HEAP_TRIM 时还给系统
+#define HEAP_GROW 0x20000
+#define HEAP_TRIM 0x40000
+
+#define CHUNK_SIZE(chunk) ((chunk)->size & ~CHUNK_FLAGS)
+#define CHUNK_AT(addr) ((chunk_t*)(addr))
+#define CHUNK_DATA(chunk) ((void*)((u32)(chunk) + CHUNK_HEAD))
+#define DATA_CHUNK(ptr) ((chunk_t*)((u32)(ptr) - CHUNK_HEAD))
+
+#define ROUND_UP(num, size) (((num) + (size) - 1) & ~((size) - 1))
+
+// 链接器给出的程序结束地址，堆从这里开始
+extern char end[];
+
+static struct
+{
+    u32 start;                  // 堆开始的地址
+    u32 brk;                    // 堆结束的地址
+    chunk_t* top;               // 顶块，从这里到 brk 的空间还没有分出去
+    chunk_t* bins[BIN_NR];      // 空闲链表
+    u32 map[(BIN_NR + 31) / 32];// 非空的空闲链表位图
+} heap;
+
+// 块大小对应的空闲链表
+static u32 bin_index(u32 size)
+{
+    if (size < SMALL_MAX)
+        return size / 8;
+    return SMALL_BINS + bit_last(size) - 10;
+}
+
+// 把空闲块放入链表，大块的链表按大小排序，第一个满足的就是最合适的
+static void bin_insert(chunk_t* chunk)
+{
+    u32 size = CHUNK_SIZE(chunk);
+    u32 idx = bin_index(size);
+    chunk_t* prev = NULL;
+    chunk_t* next = heap.bins[idx];
+
+    if (idx >= SMALL_BINS)
+    {
+        while (next && CHUNK_SIZE(next) < size)
+        {
+            prev = next;
+            next = next->next;
+        }
+    }
+
+    chunk->prev = prev;
+    chunk->next = next;
+    if (prev)
+        prev->next = chunk;
+    else
+        heap.bins[idx] = chunk;
+    if (next)
+        next->prev = chunk;
+
+    heap.map[idx / 32] |= (1 << (idx % 32));
+}
+
+// 从链表中取下空闲块
+static void bin_remove(chunk_t* chunk)
+{
+    u32 idx = bin_index(CHUNK_SIZE(chunk));
+
+    if (chunk->prev)
+        chunk->prev->next = chunk->next;
+    else
+        heap.bins[idx] = chunk->next;
+    if (chunk->next)
+        chunk->next->prev = chunk->prev;
+
+    if (!heap.bins[idx])
+        heap.map[idx / 32] &= ~(1 << (idx % 32));
+}
+
+// 找到至少 size 大小的空闲块，没有返回 NULL
+static chunk_t* bin_find(u32 size)
+{
+    u32 idx = bin_index(size);
+    chunk_t* chunk = heap.bins[idx];
+
+    // 大块的链表中找第一个够大的
+    while (chunk && CHUNK_SIZE(chunk) < size)
+        chunk = chunk->next;
+    if (chunk)
+        return chunk;
+
+    // 更大的链表中的块一定够大，取最小的链表的第一块
+    idx++;
+    for (u32 i = idx / 32; i < sizeof(heap.map) / sizeof(u32); i++)
+    {
+        u32 bits = heap.map[i];
+        if (i == idx / 32)
+            bits &= ~((1 << (idx % 32)) - 1);
+        if (bits)
+            return heap.bins[i * 32 + bit_first(bits)];
+    }
+    return NULL;
+}
+
+// 顶部的空闲空间太多时缩小堆
+static void heap_trim()
+{
+    u32 top = (u32)heap.top;
+    if (heap.brk - top <= HEAP_TRIM)
+        return;
+
+    u32 addr = ROUND_UP(top, PAGE_SIZE) + HEAP_GROW;
+    if (brk((void*)addr) == 0)
+        heap.brk = addr;
+}
+
+// 增长堆，使顶块至少有 size 大小
+static bool heap_grow(u32 size)
+{
+    if (!heap.start)
+    {
+        heap.start = ROUND_UP((u32)end, PAGE_SIZE);
+        heap.brk = heap.start;
+        heap.top = CHUNK_AT(heap.start);
+    }
+
+    u32 need = (u32)heap.top + size;
+    if (need < size || need > USER_MMAP_ADDR)
+        return false;
+    need = ROUND_UP(need, PAGE_SIZE);
+
+    // 一次多要一些，减少系统调用，失败了再只要需要的部分
+    u32 addr = MIN(MAX(need, heap.brk + HEAP_GROW), USER_MMAP_ADDR);
+    if (brk((void*)addr) < 0)
+    {
+        addr = need;
+        if (brk((void*)addr) < 0)
+            return false;
+    }
+    heap.brk = addr;
+    return true;
+}
+
+// 释放一块，与前后的空闲块合并，与顶块相邻就并入顶块
+static void chunk_free(chunk_t* chunk)
+{
+    u32 size = CHUNK_SIZE(chunk);
+    chunk_t* next = CHUNK_AT((u32)chunk + size);
+
+    if (!(chunk->size & CHUNK_PREV_USED))
+    {
+        chunk_t* prev = CHUNK_AT((u32)chunk - chunk->prev_size);
+        bin_remove(prev);
+        size += CHUNK_SIZE(prev);
+        chunk = prev;
+    }
+
+    if (next == heap.top)
+    {
+        heap.top = chunk;
+        heap_trim();
+        return;
+    }
+
+    if (!(next->size & CHUNK_USED))
+    {
+        bin_remove(next);
+        size += CHUNK_SIZE(next);
+        next = CHUNK_AT((u32)chunk + size);
+    }
+
+    // 空闲块的前一块一定在使用，后一块也在使用，不会是顶块
+    chunk->size = size | CHUNK_PREV_USED;
+    next->prev_size = size;
+    next->size &= ~CHUNK_PREV_USED;
+    bin_insert(chunk);
+}
+
+// 使用中的块只保留 size 大小，多出来的部分释放
+static void chunk_split(chunk_t* chunk, u32 size)
+{
+    u32 rest = CHUNK_SIZE(chunk) - size;
+    if (rest < CHUNK_MIN)
+        return;
+
+    chunk->size = size | (chunk->size & CHUNK_FLAGS);
+    chunk_t* next = CHUNK_AT((u32)chunk + size);
+    next->size = rest | CHUNK_USED | CHUNK_PREV_USED;
+    chunk_free(next);
+}
+
+// 请求的字节数对应的块大小，太大返回 0
+static u32 chunk_request(size_t size)
+{
+    if (size > USER_MMAP_ADDR)
+        return 0;
+    return MAX(ROUND_UP(size + CHUNK_HEAD, 8), CHUNK_MIN);
+}
+
+// 大块直接映射匿名内存，释放时还给系统
+static void* mmap_alloc(u32 size)
+{
+    size = ROUND_UP(size, PAGE_SIZE);
+    chunk_t* chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, EOF, 0);
+    if ((int)chunk == EOF)
+        return NULL;
+    chunk->size = size | CHUNK_USED | CHUNK_MMAP;
+    return CHUNK_DATA(chunk);
+}
+
+void* malloc(size_t size)
+{
+    u32 need = chunk_request(size);
+    if (!need)
+        return NULL;
+
+    if (need >= MMAP_THRESHOLD)
+        return mmap_alloc(need);
+
+    chunk_t* chunk = bin_find(need);
+    if (chunk)
+    {
+        bin_remove(chunk);
+        chunk->size |= CHUNK_USED;
+        chunk_t* next = CHUNK_AT((u32)chunk + CHUNK_SIZE(chunk));
+        if (next != heap.top)
+            next->size |= CHUNK_PREV_USED;
+        chunk_split(chunk, need);
+        return CHUNK_DATA(chunk);
+    }
+
+    // 从顶块分出去，顶块的前一块一定在使用
+    if (heap.brk - (u32)heap.top < need && !heap_grow(need))
+        return NULL;
+
+    chunk = heap.top;
+    chunk->size = need | CHUNK_USED | CHUNK_PREV_USED;
+    heap.top = CHUNK_AT((u32)chunk + need);
+    return CHUNK_DATA(chunk);
+}
+
+void free(void* ptr)
+{
+    if (!ptr)
+        return;
+
+    chunk_t* chunk = DATA_CHUNK(ptr);
+    assert(chunk->size & CHUNK_USED);
+
+    if (chunk->size & CHUNK_MMAP)
+    {
+        munmap(chunk, CHUNK_SIZE(chunk));
+        return;
+    }
+    chunk_free(chunk);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    if (size && count > (u32)-1 / size)
+        return NULL;
+
+    void* ptr = malloc(count * size);
+    if (!ptr)
+        return NULL;
+
+    // 映射的匿名内存本来就是 0
+    if (!(DATA_CHUNK(ptr)->size & CHUNK_MMAP))
+        memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    if (!ptr)
+        return malloc(size);
+    if (!size)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    u32 need = chunk_request(size);
+    if (!need)
+        return NULL;
+
+    chunk_t* chunk = DATA_CHUNK(ptr);
+    u32 old = CHUNK_SIZE(chunk);
+
+    if (chunk->size & CHUNK_MMAP)
+    {
+        if (need <= old)
+            return ptr;
+    }
+    else if (need <= old)
+    {
+        chunk_split(chunk, need);
+        return ptr;
+    }
+    else
+    {
+        // 后面是顶块或者足够大的空闲块，原地增长
+        chunk_t* next = CHUNK_AT((u32)chunk + old);
+        if (next == heap.top && need < MMAP_THRESHOLD)
+        {
+            if (heap.brk - (u32)chunk < need && !heap_grow(need - old))
+                return NULL;
+            chunk->size = need | (chunk->size & CHUNK_FLAGS);
+            heap.top = CHUNK_AT((u32)chunk + need);
+            return ptr;
+        }
+        if (next != heap.top && !(next->size & CHUNK_USED) && old + CHUNK_SIZE(next) >= need)
+        {
+            bin_remove(next);
+            chunk->size += CHUNK_SIZE(next);
+            next = CHUNK_AT((u32)chunk + CHUNK_SIZE(chunk));
+            if (next != heap.top)
+                next->size |= CHUNK_PREV_USED;
+            chunk_split(chunk, need);
+            return ptr;
+        }
+    }
+
+    void* new_ptr = malloc(size);
+    if (!new_ptr)
+        return NULL;
+    memcpy(new_ptr, ptr, MIN(old - CHUNK_HEAD, size));
+    free(ptr);
+    return new_ptr;
+}
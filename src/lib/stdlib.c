@@ -26,6 +26,38 @@ u32 div_round_up(u32 num, u32 size)
     return (num + size - 1) / size;
 }
 
+u64 div_u64(u64 dividend, u32 divisor, u32* remainder)
+{
+    // 32 位下 u64 的除法需要 libgcc，这里用两次 divl
+    // 先除高 32 位，余数小于除数，第二次的商一定放得下
+    u32 high = dividend >> 32;
+    u32 low = (u32)dividend;
+    u32 quotient_high = high / divisor;
+    u32 quotient_low;
+    u32 rem;
+    high %= divisor;
+    asm volatile("divl %4\n"
+                 : "=a"(quotient_low), "=d"(rem)
+                 : "a"(low), "d"(high), "rm"(divisor));
+    if (remainder)
+        *remainder = rem;
+    return ((u64)quotient_high << 32) | quotient_low;
+}
+
+// 伪随机数的状态，默认种子为 1
+static u32 rand_seed = 1;
+
+int rand()
+{
+    rand_seed = rand_seed * 1103515245 + 12345;
+    return (rand_seed >> 16) & RAND_MAX;
+}
+
+void srand(u32 seed)
+{
+    rand_seed = seed;
+}
+
 int atoi(const char* str)
 {
     if (str == NULL)
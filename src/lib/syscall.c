@@ -50,7 +50,7 @@ static _inline u32 _syscall4(u32 nr, u32 arg1, u32 arg2, u32 arg3, u32 arg4)
     asm volatile(
         "int $0x80\n"
         : "=a"(ret)
-        : "a"(nr), "b"(arg1), "c"(arg2), "d"(arg3), "s"(arg4));
+        : "a"(nr), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4));
     return ret;
 }
 
@@ -60,7 +60,7 @@ static _inline u32 _syscall5(u32 nr, u32 arg1, u32 arg2, u32 arg3, u32 arg4, u32
     asm volatile(
         "int $0x80\n"
         : "=a"(ret)
-        : "a"(nr), "b"(arg1), "c"(arg2), "d"(arg3), "s"(arg4), "D"(arg5));
+        : "a"(nr), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4), "D"(arg5));
     return ret;
 }
 
@@ -97,6 +97,11 @@ void sleep(u32 ms)
     _syscall1(SYS_NR_SLEEP, (u32)ms);
 }
 
+int nanosleep(const timespec* req, timespec* rem)
+{
+    return _syscall2(SYS_NR_NANOSLEEP, (u32)req, (u32)rem);
+}
+
 int32 write(fd_t fd, char* buf, u32 len)
 {
     return _syscall3(SYS_NR_WRITE, (u32)fd, (u32)buf, (u32)len);
@@ -107,6 +112,11 @@ int32 read(fd_t fd, char* buf, u32 len)
     return _syscall3(SYS_NR_READ, (u32)fd, (u32)buf, (u32)len);
 }
 
+int ioctl(fd_t fd, int cmd, void* args)
+{
+    return _syscall3(SYS_NR_IOCTL, (u32)fd, (u32)cmd, (u32)args);
+}
+
 pid_t getpid()
 {
     _syscall0(SYS_NR_GETPID);
@@ -122,6 +132,13 @@ pid_t fork()
     return _syscall0(SYS_NR_FORK);
 }
 
+// vfork 在 lib/vfork.asm 中实现，子进程会覆盖共享的用户栈
+
+pid_t spawn(char* filename, char* argv[], char* envp[], spawn_action_t* actions)
+{
+    return _syscall4(SYS_NR_SPAWN, (u32)filename, (u32)argv, (u32)envp, (u32)actions);
+}
+
 void exit(int status)
 {
     _syscall1(SYS_NR_EXIT, (u32)status);
@@ -138,6 +155,26 @@ time_t time()
     return _syscall0(SYS_NR_TIME);
 }
 
+int clock_stat(clock_stat_t* stat)
+{
+    return _syscall1(SYS_NR_CLOCK_STAT, (u32)stat);
+}
+
+int clock_gettime(int clockid, timespec* tp)
+{
+    return _syscall2(SYS_NR_CLOCK_GETTIME, (u32)clockid, (u32)tp);
+}
+
+int memory_stat(memory_stat_t* stat)
+{
+    return _syscall1(SYS_NR_MEMORY_STAT, (u32)stat);
+}
+
+int slab_stat(slab_stat_t* stats, int count)
+{
+    return _syscall2(SYS_NR_SLAB_STAT, (u32)stats, (u32)count);
+}
+
 mode_t umask(mode_t mask)
 {
     return _syscall1(SYS_NR_UMASK, (u32)mask);
@@ -249,6 +286,11 @@ int munmap(void* addr, size_t length)
     return _syscall2(SYS_NR_MUNMAP, (u32)addr, (u32)length);
 }
 
+int msync(void* addr, size_t length, int flags)
+{
+    return _syscall3(SYS_NR_MSYNC, (u32)addr, (u32)length, (u32)flags);
+}
+
 int execve(char* filename, char* argvp[], char* envp[])
 {
     return _syscall3(SYS_NR_EXECVE, (u32)filename, (u32)argvp, (u32)envp);
@@ -0,0 +1,17 @@
+[bits 32]
+
+section .text
+
+SYS_NR_VFORK equ 190
+
+global vfork
+
+; vfork 的子进程与父进程共享用户栈，子进程从 vfork 返回之后，
+; 再调用其他函数就会覆盖栈中 vfork 的返回地址，父进程恢复执行时就回不去了
+; 所以先把返回地址弹出保存在 ecx 中，系统调用返回后再压回栈中
+vfork:
+    pop ecx; 返回地址
+    mov eax, SYS_NR_VFORK
+    int 0x80
+    push ecx
+    ret